@@ -0,0 +1,506 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+/*
+ * Throughput benchmark of the hashing backends and of the miner itself.
+ *
+ * Every run hashes the same fixed headers against the same targets, so numbers are comparable
+ * across builds and machines. Progress goes to stderr, the results to stdout as one JSON object:
+ *  - single and double SHA-256 of an 80-byte header per crypto::sha256 backend,
+ *  - header engines (cached midstate with the kernel resolved once and per block, multi-buffer
+ *    lanes: full digest and check-only probe),
+ *  - share checks against a 256-bit target: byte by byte and with the precomputed target256,
+ *  - miner hashrate at 1, 2, 4, .. N workers and its scaling efficiency against one worker,
+ *  - job-switch latency of miner::preempt, up to the hand-off and up to the first hashed batch,
+ *  - thread queue throughput under contention: spsc_queue, mpmc_queue and the mutex-based
+ *    thread_q they replaced, at 1:1 up to N:N producers and consumers,
+ *  - cost of a log call on the calling thread: the asynchronous logger (enabled and filtered
+ *    out) and the synchronous applog it replaced, 1 up to N logging threads.
+ *
+ * usage: ezminer_bench [--threads N] [--seconds S] [--switches K] [--items I]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/time.h>
+
+#include "cpu_topology.h"
+#include "header_hasher.h"
+#include "logger.h"
+#include "miner.h"
+#include "sha256_inline.h"
+#include "sha256_lanes.h"
+#include "sha256_openssl.h"
+#include "sha256_shani.h"
+#include "target.h"
+#include "thread_queue.h"
+
+namespace {
+
+    using clock = std::chrono::steady_clock;
+    using header_t = crypto::sha256_lanes::header_t;
+    using hash_t = crypto::sha256::hash_t;
+
+    struct options {
+        unsigned threads = cpu_topology::get().cpu_count();
+        double seconds = 1.0;       // per measurement
+        unsigned switches = 20;
+        unsigned items = 1 << 20;   // per queue measurement
+    };
+
+    // keeps the optimizer from dropping the hashes
+    volatile unsigned char sink;
+
+    header_t fixed_header(unsigned index) {
+        header_t header = {0};
+        for(unsigned i = 0; i < 76; ++i)
+            header[i] = static_cast<unsigned char>(i * 131 + index * 17 + 7);
+        return header;
+    }
+
+    // calls `step` (which hashes `per_call` items) until `seconds` have passed, returns items per second
+    template<typename Step>
+    double measure(double seconds, unsigned per_call, Step&& step) {
+        std::uint64_t calls = 0;
+        const auto start = clock::now();
+        const auto deadline = start + std::chrono::duration<double>(seconds);
+        auto now = start;
+        do {
+            for(unsigned i = 0; i < 64; ++i)
+                step(static_cast<std::uint32_t>(calls + i));
+            calls += 64;
+            now = clock::now();
+        } while(now < deadline);
+        return calls * per_call / std::chrono::duration<double>(now - start).count();
+    }
+
+    template<typename Sha256>
+    hash_t digest(const unsigned char* data, std::size_t length) {
+        Sha256 context;
+        context.update(data, length);
+        return context.finalize();
+    }
+
+    struct backend_result {
+        const char* name;
+        double single;
+        double double_;
+    };
+
+    template<typename Sha256>
+    backend_result sha256_backend(const char* name, const options& opts) {
+        auto header = fixed_header(0);
+        backend_result result { name, 0, 0 };
+        result.single = measure(opts.seconds, 1, [&](std::uint32_t nonce) {
+            std::memcpy(header.data() + 76, &nonce, 4);
+            sink = digest<Sha256>(header.data(), header.size())[0];
+        });
+        result.double_ = measure(opts.seconds, 1, [&](std::uint32_t nonce) {
+            std::memcpy(header.data() + 76, &nonce, 4);
+            auto first = digest<Sha256>(header.data(), header.size());
+            sink = digest<Sha256>(first.data(), first.size())[0];
+        });
+        return result;
+    }
+
+    // job of the miner runs: the check accepts nothing unless `accept`, so a job can be made endless
+    struct job {
+        crypto::sha256_lanes hasher;
+        std::uint32_t top_limit;
+        bool accept;
+        std::atomic_flag* started = nullptr;    // raised by the first batch hashed of the job
+    };
+
+    struct candidate {
+        unsigned nonce;
+        std::uint32_t top;
+    };
+
+    auto make_miner(unsigned threads) {
+        return miner(
+                job { crypto::sha256_lanes(fixed_header(0)), 0, false },
+                [](job& j, nonce_range range, std::span<candidate> candidates) {
+                    if(j.started && !j.started->test_and_set())
+                        j.started->notify_all();
+                    std::size_t count = 0;
+                    crypto::sha256_lanes::top_batch_t tops;
+                    for(unsigned base = 0; base < range.count; base += tops.size()) {
+                        j.hasher.probe(range.first + base, tops);
+                        for(unsigned i = 0; i < tops.size(); ++i)
+                            if(tops[i] <= j.top_limit)
+                                candidates[count++] = { range.first + base + i, tops[i] };
+                    }
+                    return count;
+                },
+                [](const job& j, std::span<const candidate> candidates) -> std::optional<std::size_t> {
+                    if(j.accept && !candidates.empty())
+                        return 0;
+                    return std::nullopt;
+                },
+                miner_options { threads, true });
+    }
+
+    struct scaling_result {
+        unsigned threads;
+        double hashrate;
+        double efficiency;
+    };
+
+    // fixed headers at a 2^-24 target, as many as fit in the time budget
+    double miner_hashrate(unsigned threads, const options& opts) {
+        auto miner_obj = make_miner(threads);
+        const auto deadline = clock::now() + std::chrono::duration<double>(opts.seconds);
+        unsigned index = 0;
+        do {
+            miner_obj.do_work(job { crypto::sha256_lanes(fixed_header(index++)), 0xff, true });
+        } while(clock::now() < deadline);
+        return miner_obj.stats().hashrate;
+    }
+
+    struct switch_result {
+        unsigned samples;
+        double mean_us;
+        double max_us;
+        double first_hash_mean_us;      // preempt() until the new job's first batch was hashed
+        double first_hash_max_us;
+    };
+
+    // an endless job preempted by one that succeeds on its first batch
+    switch_result job_switch(unsigned threads, const options& opts) {
+        auto miner_obj = make_miner(threads);
+        double total = 0, first_hash = 0;
+        for(unsigned sample = 0; sample < opts.switches; ++sample) {
+            // preempted only once the endless job is being hashed, so every sample is a switch
+            std::atomic_flag started;
+            std::thread preempter([&] {
+                started.wait(false);
+                miner_obj.preempt(job { crypto::sha256_lanes(fixed_header(sample + 1)), 0xffffffffu, true });
+            });
+            miner_obj.do_work(job { crypto::sha256_lanes(fixed_header(0)), 0, false, &started });
+            preempter.join();
+            auto preemption = miner_obj.preemption();
+            total += std::chrono::duration<double, std::micro>(preemption.last).count();
+            first_hash += std::chrono::duration<double, std::micro>(preemption.last_first_hash).count();
+        }
+        auto preemption = miner_obj.preemption();
+        const double samples = preemption.count ? static_cast<double>(preemption.count) : 1;
+        return { static_cast<unsigned>(preemption.count), total / samples,
+                 std::chrono::duration<double, std::micro>(preemption.max).count(),
+                 first_hash / samples, std::chrono::duration<double, std::micro>(preemption.max_first_hash).count() };
+    }
+
+    // the thread_q of util.cpp before the lock-free queues: a node allocated per push, a lock and a signal per operation
+    class locked_queue {
+    public:
+        explicit locked_queue(std::size_t) {
+        }
+
+        ~locked_queue() {
+            while(m_head) {
+                auto next = m_head->next;
+                std::free(m_head);
+                m_head = next;
+            }
+        }
+
+        bool push(void* data) {
+            auto entry = static_cast<node*>(std::calloc(1, sizeof(node)));
+            if(!entry)
+                return false;
+            entry->data = data;
+            std::lock_guard lock(m_lock);
+            (m_tail ? m_tail->next : m_head) = entry;
+            m_tail = entry;
+            m_wake.notify_one();
+            return true;
+        }
+
+        std::optional<void*> pop_for(std::chrono::milliseconds timeout) {
+            std::unique_lock lock(m_lock);
+            if(!m_head && !m_wake.wait_for(lock, timeout, [this] { return m_head != nullptr; }))
+                return std::nullopt;
+            auto entry = m_head;
+            m_head = entry->next;
+            if(!m_head)
+                m_tail = nullptr;
+            lock.unlock();
+            auto data = entry->data;
+            std::free(entry);
+            return data;
+        }
+
+    private:
+        struct node {
+            void* data;
+            node* next;
+        };
+
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        node* m_head = nullptr;
+        node* m_tail = nullptr;
+    };
+
+    struct queue_result {
+        const char* queue;
+        unsigned producers;
+        unsigned consumers;
+        double ops;     // items through the queue per second
+    };
+
+    // `items` pointers through a 256-slot queue, producers retrying while it is full
+    template<typename Queue>
+    queue_result queue_throughput(const char* name, unsigned producers, unsigned consumers, const options& opts) {
+        Queue queue(256);
+        const std::uint64_t items = opts.items;
+        std::atomic<std::uint64_t> consumed { 0 };
+        std::vector<std::thread> threads;
+
+        const auto start = clock::now();
+        for(unsigned producer = 0; producer < producers; ++producer)
+            threads.emplace_back([&, producer] {
+                for(std::uint64_t item = producer; item < items; item += producers)
+                    while(!queue.push(reinterpret_cast<void*>(item + 1)))
+                        std::this_thread::yield();
+            });
+        for(unsigned consumer = 0; consumer < consumers; ++consumer)
+            threads.emplace_back([&] {
+                while(consumed.load(std::memory_order::relaxed) < items)
+                    if(auto item = queue.pop_for(std::chrono::milliseconds(1)))
+                        consumed.fetch_add(1, std::memory_order::relaxed);
+            });
+        for(auto&& thread : threads)
+            thread.join();
+        return { name, producers, consumers, items / std::chrono::duration<double>(clock::now() - start).count() };
+    }
+
+    // applog before the asynchronous logger: a global lock around localtime, the format rebuilt, a write per call
+    std::mutex applog_lock;
+
+    void locked_applog(std::FILE* output, const char* format, ...) {
+        timeval now {};
+        gettimeofday(&now, nullptr);
+        std::tm local {};
+        {
+            std::lock_guard lock(applog_lock);
+            local = *std::localtime(&now.tv_sec);
+        }
+        char stamped[256];
+        std::snprintf(stamped, sizeof(stamped), "[%d-%02d-%02d %02d:%02d:%02d] %s\n", local.tm_year + 1900, local.tm_mon + 1,
+                      local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec, format);
+        std::va_list args;
+        va_start(args, format);
+        std::vfprintf(output, stamped, args);
+        va_end(args);
+    }
+
+    struct log_result {
+        const char* logger;
+        unsigned threads;
+        double ns;      // per call, on the calling thread
+    };
+
+    // bursts of 256 calls per thread (well within a logger ring), drained between the bursts
+    template<typename Log>
+    log_result log_latency(const char* name, unsigned threads, const options& opts, Log log) {
+        constexpr unsigned Burst = 256;
+        const unsigned bursts = std::max(1u, opts.items / (Burst * 64));
+        std::atomic<std::uint64_t> nanoseconds { 0 };
+        std::vector<std::thread> loggers;
+        for(unsigned thread = 0; thread < threads; ++thread)
+            loggers.emplace_back([&, thread] {
+                for(unsigned burst = 0; burst < bursts; ++burst) {
+                    const auto start = clock::now();
+                    for(unsigned call = 0; call < Burst; ++call)
+                        log(thread, call);
+                    nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+                    logging::flush();
+                }
+            });
+        for(auto&& thread : loggers)
+            thread.join();
+        return { name, threads, static_cast<double>(nanoseconds) / (static_cast<double>(threads) * bursts * Burst) };
+    }
+
+    options parse(int argc, char** argv) {
+        options result;
+        for(int i = 1; i + 1 < argc; i += 2) {
+            std::string name = argv[i];
+            if(name == "--threads")
+                result.threads = std::max(1, std::atoi(argv[i + 1]));
+            else if(name == "--seconds")
+                result.seconds = std::max(0.01, std::atof(argv[i + 1]));
+            else if(name == "--switches")
+                result.switches = std::max(1, std::atoi(argv[i + 1]));
+            else if(name == "--items")
+                result.items = std::max(1, std::atoi(argv[i + 1]));
+            else
+                std::cerr << "unknown option " << name << std::endl;
+        }
+        return result;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    const auto opts = parse(argc, argv);
+    const auto& topology = cpu_topology::get();
+
+    std::cerr << "sha256 backends" << std::endl;
+    std::vector<backend_result> backends {
+        sha256_backend<crypto::sha256_openssl>("openssl", opts),
+        sha256_backend<crypto::sha256_inline>("inline", opts),
+        sha256_backend<crypto::sha256_shani>(crypto::sha256_shani::accelerated() ? "shani" : "shani (scalar fallback)", opts),
+    };
+
+    std::cerr << "header engines" << std::endl;
+    const auto header = fixed_header(0);
+    // the kernel resolved once for the whole loop, as a job's search does
+    const double midstate_rate = crypto::dispatch_transform([&](auto kernel) {
+        const crypto::header_hasher<crypto::basic_sha256<typename decltype(kernel)::type>> midstate(header);
+        return measure(opts.seconds, 1, [&](std::uint32_t nonce) {
+            sink = midstate.compute(nonce)[0];
+        });
+    });
+    // the default policy, dispatched through a function pointer per block
+    const crypto::header_hasher<> per_block(header);
+    const double per_block_rate = measure(opts.seconds, 1, [&](std::uint32_t nonce) {
+        sink = per_block.compute(nonce)[0];
+    });
+    const crypto::sha256_lanes lanes(header);
+    crypto::sha256_lanes::batch_t batch;
+    const double lanes_rate = measure(opts.seconds, crypto::sha256_lanes::batch_size, [&](std::uint32_t call) {
+        lanes.compute(call * crypto::sha256_lanes::batch_size, batch);
+        sink = batch[0][0];
+    });
+    crypto::sha256_lanes::top_batch_t tops;
+    const double probe_rate = measure(opts.seconds, crypto::sha256_lanes::batch_size, [&](std::uint32_t call) {
+        lanes.probe(call * crypto::sha256_lanes::batch_size, tops);
+        sink = static_cast<unsigned char>(tops[0]);
+    });
+
+    std::cerr << "target checks" << std::endl;
+    // hashes that share the target's top 32 bits, the ones the probe stage lets through
+    std::array<hash_t, 64> hashes;
+    const auto share_target = crypto::target256::from_difficulty(65536);
+    for(unsigned i = 0; i < hashes.size(); ++i) {
+        hashes[i] = digest<crypto::sha256_inline>(fixed_header(i).data(), 80);
+        std::memcpy(hashes[i].data() + 28, share_target.to_le().data() + 28, 4);
+    }
+    const auto target_bytes = share_target.to_le();
+    const double byte_check_rate = measure(opts.seconds, 1, [&](std::uint32_t call) {
+        const auto& hash = hashes[call % hashes.size()];
+        bool met = true;
+        for(unsigned i = 32; i-- > 0;)
+            if(hash[i] != target_bytes[i]) {
+                met = hash[i] < target_bytes[i];
+                break;
+            }
+        sink = met;
+    });
+    const double target_check_rate = measure(opts.seconds, 1, [&](std::uint32_t call) {
+        sink = share_target.met_by(hashes[call % hashes.size()]);
+    });
+
+    std::vector<unsigned> counts;
+    for(unsigned threads = 1; threads < opts.threads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(opts.threads);
+
+    std::vector<scaling_result> scaling;
+    for(auto threads : counts) {
+        std::cerr << "miner, " << threads << " workers" << std::endl;
+        auto hashrate = miner_hashrate(threads, opts);
+        auto base = scaling.empty() ? hashrate : scaling.front().hashrate;
+        scaling.push_back({ threads, hashrate, base > 0 ? hashrate / (base * threads) : 0 });
+    }
+
+    std::cerr << "job switch, " << opts.threads << " workers" << std::endl;
+    const auto switching = job_switch(opts.threads, opts);
+
+    std::cerr << "thread queues" << std::endl;
+    std::vector<queue_result> queues {
+        queue_throughput<spsc_queue<void*>>("spsc", 1, 1, opts),
+    };
+    for(unsigned side = 1; side <= std::max(1u, opts.threads / 2); side *= 2) {
+        queues.push_back(queue_throughput<mpmc_queue<void*>>("mpmc", side, side, opts));
+        queues.push_back(queue_throughput<locked_queue>("thread_q", side, side, opts));
+    }
+
+    std::cerr << "logging" << std::endl;
+    const auto null_output = std::fopen("/dev/null", "w");
+    logging::set_output(null_output);
+    std::vector<log_result> logs;
+    for(unsigned threads = 1; threads <= opts.threads; threads *= 2) {
+        logs.push_back(log_latency("async", threads, opts, [](unsigned thread, unsigned call) {
+            logging::write(logging::info, "thread %u: share %u %s", thread, call, "accepted");
+        }));
+        logging::set_level(logging::info);
+        logs.push_back(log_latency("async_filtered", threads, opts, [](unsigned thread, unsigned call) {
+            logging::write(logging::debug, "thread %u: share %u %s", thread, call, "accepted");
+        }));
+        logging::set_level(logging::debug);
+        logs.push_back(log_latency("applog", threads, opts, [null_output](unsigned thread, unsigned call) {
+            locked_applog(null_output, "thread %u: share %u %s", thread, call, "accepted");
+        }));
+    }
+    logging::flush();
+    logging::set_output(stderr);
+    std::fclose(null_output);
+
+    std::cout << "{\n"
+              << "  \"cpus\": " << topology.cpu_count() << ",\n"
+              << "  \"numa_nodes\": " << topology.nodes.size() << ",\n"
+              << "  \"lanes_backend\": \"" << crypto::sha256_lanes::backend() << "\",\n"
+              << "  \"seconds_per_measurement\": " << opts.seconds << ",\n"
+              << "  \"sha256\": [\n";
+    for(std::size_t i = 0; i < backends.size(); ++i)
+        std::cout << "    { \"backend\": \"" << backends[i].name << "\", \"single_hs\": " << backends[i].single
+                  << ", \"double_hs\": " << backends[i].double_ << " }" << (i + 1 < backends.size() ? "," : "") << "\n";
+    std::cout << "  ],\n"
+              << "  \"header\": {\n"
+              << "    \"header_hasher_hs\": " << midstate_rate << ",\n"
+              << "    \"header_hasher_per_block_dispatch_hs\": " << per_block_rate << ",\n"
+              << "    \"lanes_hs\": " << lanes_rate << ",\n"
+              << "    \"lanes_probe_hs\": " << probe_rate << "\n"
+              << "  },\n"
+              << "  \"target_check\": { \"bytewise_per_s\": " << byte_check_rate << ", \"target256_per_s\": " << target_check_rate << " },\n"
+              << "  \"miner\": [\n";
+    for(std::size_t i = 0; i < scaling.size(); ++i)
+        std::cout << "    { \"threads\": " << scaling[i].threads << ", \"hs\": " << scaling[i].hashrate
+                  << ", \"efficiency\": " << scaling[i].efficiency << " }" << (i + 1 < scaling.size() ? "," : "") << "\n";
+    std::cout << "  ],\n"
+              << "  \"job_switch\": { \"threads\": " << opts.threads << ", \"samples\": " << switching.samples
+              << ", \"mean_us\": " << switching.mean_us << ", \"max_us\": " << switching.max_us
+              << ", \"first_hash_mean_us\": " << switching.first_hash_mean_us << ", \"first_hash_max_us\": " << switching.first_hash_max_us << " },\n"
+              << "  \"queues\": [\n";
+    for(std::size_t i = 0; i < queues.size(); ++i)
+        std::cout << "    { \"queue\": \"" << queues[i].queue << "\", \"producers\": " << queues[i].producers
+                  << ", \"consumers\": " << queues[i].consumers << ", \"ops\": " << queues[i].ops << " }"
+                  << (i + 1 < queues.size() ? "," : "") << "\n";
+    std::cout << "  ],\n"
+              << "  \"logging\": [\n";
+    for(std::size_t i = 0; i < logs.size(); ++i)
+        std::cout << "    { \"logger\": \"" << logs[i].logger << "\", \"threads\": " << logs[i].threads
+                  << ", \"ns_per_call\": " << logs[i].ns << " }" << (i + 1 < logs.size() ? "," : "") << "\n";
+    std::cout << "  ]\n"
+              << "}" << std::endl;
+}
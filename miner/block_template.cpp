@@ -0,0 +1,198 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "block_template.h"
+#include "hex.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    constexpr unsigned Extranonce2Size = 8;
+    constexpr std::size_t MaxScriptSig = 100;
+
+    using bytes = std::vector<unsigned char>;
+
+    mining_job::hash_t sha256d(const unsigned char* data, std::size_t length) {
+        crypto::sha256_inline first;
+        first.update(data, length);
+        auto hash = first.finalize();
+        crypto::sha256_inline second;
+        second.update(hash.data(), hash.size());
+        return second.finalize();
+    }
+
+    void put_le(bytes& out, std::uint64_t value, unsigned size) {
+        for(unsigned i = 0; i < size; ++i)
+            out.push_back(static_cast<unsigned char>(value >> (i * 8)));
+    }
+
+    // Bitcoin's CompactSize length prefix
+    void put_varint(bytes& out, std::uint64_t value) {
+        if(value < 0xfd) {
+            out.push_back(static_cast<unsigned char>(value));
+        } else if(value <= 0xffff) {
+            out.push_back(0xfd);
+            put_le(out, value, 2);
+        } else if(value <= 0xffffffff) {
+            out.push_back(0xfe);
+            put_le(out, value, 4);
+        } else {
+            out.push_back(0xff);
+            put_le(out, value, 8);
+        }
+    }
+
+    // hash given in RPC (display) order to internal byte order
+    bool display_hash(const json::value& value, mining_job::hash_t& out) {
+        if(!hex::decode(value.as_string(), out.data(), out.size()))
+            return false;
+        std::reverse(out.begin(), out.end());
+        return true;
+    }
+
+    bool hex_bytes(const json::value& value, bytes& out) {
+        const auto& text = value.as_string();
+        out.resize(text.size() / 2);
+        return hex::decode(text, out.data(), out.size());
+    }
+
+}
+
+std::optional<block_template> block_template::parse(const json::value& result, const options& opts) {
+    block_template tmpl;
+    auto& job = tmpl.job;
+
+    std::uint32_t bits = 0;
+    unsigned char bits_bytes[4];
+    if(!hex::decode(result["bits"].as_string(), bits_bytes, sizeof(bits_bytes)))
+        return std::nullopt;
+    for(auto byte : bits_bytes)
+        bits = bits << 8 | byte;
+
+    mining_job::hash_t target;
+    if(!display_hash(result["previousblockhash"], job.prev_hash) || !display_hash(result["target"], target)
+       || !result["height"].is_number() || !result["coinbasevalue"].is_number() || !result["curtime"].is_number())
+        return std::nullopt;
+
+    tmpl.height = result["height"].as_int();
+    tmpl.coinbase_value = static_cast<std::uint64_t>(result["coinbasevalue"].as_int());
+    tmpl.longpoll_id = result["longpollid"].as_string();
+    job.id = tmpl.longpoll_id.empty() ? std::to_string(tmpl.height) : tmpl.longpoll_id;
+    job.version = static_cast<std::uint32_t>(result["version"].as_int());
+    job.nbits = bits;
+    job.target = crypto::target256::from_le(target);
+    job.ntime = static_cast<std::uint32_t>(result["curtime"].as_int());
+    job.ntime_roll = opts.ntime_roll;
+
+    std::vector<mining_job::hash_t> txids;
+    for(const auto& tx : result["transactions"].as_array()) {
+        auto& txid = txids.emplace_back();
+        // "txid" is the witness-stripped hash the merkle tree uses; pre-segwit nodes only send "hash"
+        if(!display_hash(tx.find("txid") ? tx["txid"] : tx["hash"], txid) || !tx["data"].is_string())
+            return std::nullopt;
+        tmpl.transactions.push_back(tx["data"].as_string());
+    }
+    job.merkle_branch = coinbase_branch(std::move(txids));
+
+    bytes commitment;
+    if(result.find("default_witness_commitment")) {
+        if(!hex_bytes(result["default_witness_commitment"], commitment))
+            return std::nullopt;
+        tmpl.segwit = true;
+    }
+
+    // scriptSig: height push || extranonce2 || tag
+    auto height = height_push(tmpl.height);
+    std::string tag = opts.tag.substr(0, MaxScriptSig - std::min(MaxScriptSig, height.size() + Extranonce2Size));
+
+    bytes& prefix = job.coinbase1;
+    put_le(prefix, 1, 4);                           // version
+    put_varint(prefix, 1);                          // one input, spending nothing
+    prefix.insert(prefix.end(), 32, 0x00);
+    put_le(prefix, 0xffffffff, 4);
+    put_varint(prefix, height.size() + Extranonce2Size + tag.size());
+    prefix.insert(prefix.end(), height.begin(), height.end());
+
+    job.extranonce1.clear();
+    job.extranonce2_size = Extranonce2Size;
+
+    bytes& suffix = job.coinbase2;
+    suffix.insert(suffix.end(), tag.begin(), tag.end());
+    put_le(suffix, 0xffffffff, 4);                  // sequence
+    put_varint(suffix, tmpl.segwit ? 2 : 1);
+    put_le(suffix, tmpl.coinbase_value, 8);
+    put_varint(suffix, opts.payout_script.size());
+    suffix.insert(suffix.end(), opts.payout_script.begin(), opts.payout_script.end());
+    if(tmpl.segwit) {
+        put_le(suffix, 0, 8);
+        put_varint(suffix, commitment.size());
+        suffix.insert(suffix.end(), commitment.begin(), commitment.end());
+    }
+    put_le(suffix, 0, 4);                           // lock time
+    return tmpl;
+}
+
+std::string block_template::block(const mining_job::share& share) const {
+    auto header = job.header(job.merkle_root(share.extranonce2), share.ntime);
+    for(unsigned i = 0; i < 4; ++i)
+        header[76 + i] = static_cast<unsigned char>(share.nonce >> (i * 8));
+
+    bytes block(header.begin(), header.end());
+    put_varint(block, transactions.size() + 1);
+    auto coinbase = job.coinbase(share.extranonce2);
+    if(segwit) {
+        // marker and flag after the version, the 32-byte witness reserved value before the lock time
+        block.insert(block.end(), coinbase.begin(), coinbase.begin() + 4);
+        block.push_back(0x00);
+        block.push_back(0x01);
+        block.insert(block.end(), coinbase.begin() + 4, coinbase.end() - 4);
+        block.push_back(0x01);
+        block.push_back(0x20);
+        block.insert(block.end(), 32, 0x00);
+        block.insert(block.end(), coinbase.end() - 4, coinbase.end());
+    } else {
+        block.insert(block.end(), coinbase.begin(), coinbase.end());
+    }
+
+    auto result = hex::encode(block.data(), block.size());
+    for(const auto& tx : transactions)
+        result += tx;
+    return result;
+}
+
+std::vector<mining_job::hash_t> block_template::coinbase_branch(std::vector<mining_job::hash_t> others) {
+    std::vector<mining_job::hash_t> branch;
+    unsigned char pair[64];
+    // every level: our node's sibling goes to the branch, the rest is paired up for the next level
+    while(!others.empty()) {
+        branch.push_back(others.front());
+        std::vector<mining_job::hash_t> next;
+        if(others.size() % 2 == 0)
+            others.push_back(others.back());
+        for(std::size_t i = 1; i + 1 < others.size(); i += 2) {
+            std::memcpy(pair, others[i].data(), 32);
+            std::memcpy(pair + 32, others[i + 1].data(), 32);
+            next.push_back(sha256d(pair, sizeof(pair)));
+        }
+        others = std::move(next);
+    }
+    return branch;
+}
+
+std::vector<unsigned char> block_template::height_push(std::int64_t height) {
+    if(height == 0)
+        return { 0x00 };
+    if(height >= 1 && height <= 16)
+        return { static_cast<unsigned char>(0x50 + height) };
+    bytes number;
+    for(auto value = static_cast<std::uint64_t>(height); value; value >>= 8)
+        number.push_back(static_cast<unsigned char>(value));
+    if(number.back() & 0x80)
+        number.push_back(0x00);
+    bytes result { static_cast<unsigned char>(number.size()) };
+    result.insert(result.end(), number.begin(), number.end());
+    return result;
+}
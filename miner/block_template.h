@@ -0,0 +1,49 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "json.h"
+#include "mining_job.h"
+
+/*
+ * Solo-mining work from a node's getblocktemplate (BIP 22/23, segwit rules).
+ *
+ * The coinbase is built locally: BIP 34 height, an 8-byte extranonce2 slot and a tag in the
+ * scriptSig, the payout output and, for segwit templates, the witness commitment. It is split
+ * around the extranonce into a mining_job together with the merkle branch of the coinbase,
+ * computed once from the template's txids, so a new extranonce2 costs the coinbase hash and
+ * O(log n) merkle hashes (see job_work). block() serializes the whole block for submitblock.
+ */
+struct block_template {
+    struct options {
+        std::vector<unsigned char> payout_script;   // scriptPubKey paid by the coinbase
+        std::string tag = "/ezminer/";              // appended to the coinbase scriptSig
+        std::uint32_t ntime_roll = 0;               // seconds ntime may be moved forward
+    };
+
+    mining_job job;
+    std::int64_t height = 0;
+    std::uint64_t coinbase_value = 0;
+    bool segwit = false;                            // coinbase carries a witness commitment
+    std::vector<std::string> transactions;          // raw transactions (hex) after the coinbase
+    std::string longpoll_id;
+
+    // from the "result" of getblocktemplate, std::nullopt on a malformed template
+    static std::optional<block_template> parse(const json::value& result, const options& opts);
+
+    // serialized block (hex) for the share found on this template's job
+    std::string block(const mining_job::share& share) const;
+
+    // merkle branch of the first leaf (the coinbase) over the other leaves, internal byte order
+    static std::vector<mining_job::hash_t> coinbase_branch(std::vector<mining_job::hash_t> others);
+
+    // BIP 34: the height as the first push of the coinbase scriptSig, `CScript() << height`
+    static std::vector<unsigned char> height_push(std::int64_t height);
+};
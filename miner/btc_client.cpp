@@ -0,0 +1,349 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "btc_client.h"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <random>
+#include <span>
+#include <unordered_set>
+
+#include "hex.h"
+#include "json.h"
+
+namespace {
+
+    constexpr std::size_t HeaderSize = 80;
+    constexpr std::size_t PrevHashOffset = 4;
+    constexpr std::size_t DedupWindow = 4096;
+
+    constexpr std::string_view GetworkRequest = "{\"method\": \"getwork\", \"params\": [], \"id\":0}";
+
+    /* decodes the raw member value 'raw' (a hex string literal) straight into 'buf' */
+    bool jobj_binary(std::string_view raw, void *buf, size_t buflen)
+    {
+        auto hexstr = json::raw_string(raw);
+        if (!hexstr) {
+            return false;
+        }
+        return hex::decode(*hexstr, static_cast<unsigned char *>(buf), buflen);
+    }
+
+    /*
+     * The raw text of "result" in the JSON-RPC reply 'body', empty unless the reply has a
+     * non-null result and a null error.
+     */
+    std::string_view rpc_result(std::string_view body)
+    {
+        static constexpr std::string_view keys[] = { "result", "error" };
+        std::string_view values[2];
+
+        if (!json::scan_object(body, keys, values))
+            return {};
+        if (values[0] == "null" || (!values[1].empty() && values[1] != "null"))
+            return {};
+        return values[0];
+    }
+
+    // FNV-1a of the header (nonce included), identifies a share
+    std::uint64_t share_key(const work &unit)
+    {
+        std::uint64_t key = 0xcbf29ce484222325;
+        for (std::size_t i = 0; i < HeaderSize; ++i)
+            key = (key ^ unit.data[i]) * 0x100000001b3;
+        return key;
+    }
+
+}
+
+bool work_decode(std::string_view val, struct work *work)
+{
+    static constexpr std::string_view keys[] = { "midstate", "data", "hash1", "target" };
+    std::string_view members[4];
+
+    if (!json::scan_object(val, keys, members)) {
+        return false;
+    }
+
+    if (!jobj_binary(members[0], work->midstate, sizeof(work->midstate)) ||
+            !jobj_binary(members[1], work->data, sizeof(work->data)) ||
+            !jobj_binary(members[2], work->hash1, sizeof(work->hash1)) ||
+            !jobj_binary(members[3], work->target, sizeof(work->target))) {
+        return false;
+    }
+
+    work->share_target = crypto::target256::from_le(work->target);
+    std::memset(work->hash, 0, sizeof(work->hash));
+
+    return true;
+}
+
+bitcoin_client::bitcoin_client(std::string url, std::string userpass, std::size_t depth)
+        : m_depth(std::max<std::size_t>(depth, 1))
+          , m_rpc(std::make_unique<rpc_transport>(std::move(url), std::move(userpass), 2))
+          , m_fetcher([this] { prefetch(); })
+          , m_submitter([this] { submit_shares(); }) {
+}
+
+bitcoin_client::~bitcoin_client()
+{
+    {
+        std::lock_guard lock(m_lock);
+        m_stop = true;
+    }
+    m_changed.notify_all();
+    m_shares.freeze();                          // wakes the submit thread
+    m_rpc.reset();                              // fails the exchange either thread waits on
+    m_fetcher.join();
+    m_submitter.join();
+}
+
+bool bitcoin_client::get_work(work *wc)
+{
+    const auto started = std::chrono::steady_clock::now();
+    std::unique_lock lock(m_lock);
+    const bool empty = m_ready.empty();
+    m_changed.wait(lock, [this] { return m_stop || !m_ready.empty(); });
+    if (m_ready.empty())
+        return false;
+
+    *wc = m_ready.front().unit;
+    if (empty) {
+        ++m_stats.waited;
+        m_stats.idle += std::chrono::steady_clock::now() - started;
+    } else {
+        ++m_stats.ready;
+        m_stats.idle_avoided += m_ready.front().fetch_time;
+    }
+    m_ready.pop_front();
+    lock.unlock();
+    m_changed.notify_all();
+    return true;
+}
+
+void bitcoin_client::flush()
+{
+    {
+        std::lock_guard lock(m_lock);
+        m_ready.clear();
+    }
+    m_changed.notify_all();
+}
+
+bitcoin_client::prefetch_stats bitcoin_client::stats() const
+{
+    std::lock_guard lock(m_lock);
+    auto result = m_stats;
+    result.depth = m_ready.size();
+    return result;
+}
+
+bool bitcoin_client::submit(const work &solved)
+{
+    const bool queued = m_shares.push({ solved, std::chrono::steady_clock::now(), 0, false });
+    (queued ? m_queued : m_overflow).fetch_add(1, std::memory_order::relaxed);
+    return queued;
+}
+
+bitcoin_client::submit_stats bitcoin_client::submissions() const
+{
+    std::lock_guard lock(m_lock);
+    auto result = m_submitted;
+    result.queued = m_queued.load(std::memory_order::relaxed);
+    result.overflow = m_overflow.load(std::memory_order::relaxed);
+    return result;
+}
+
+std::chrono::milliseconds bitcoin_client::backoff(int failures)
+{
+    constexpr std::chrono::milliseconds base { 250 }, cap { 30000 };
+    thread_local std::minstd_rand random { std::random_device {}() };
+    const auto ceiling = std::min(cap, base * (std::int64_t { 1 } << std::min(failures - 1, 16)));
+    return ceiling / 2 + std::chrono::milliseconds(random() % (ceiling.count() / 2 + 1));
+}
+
+bool bitcoin_client::exchange(std::string body, const std::function<bool(std::string_view)> &read)
+{
+    std::promise<bool> done;
+    auto answered = done.get_future();
+    {
+        // m_rpc is only reset once m_stop is set, so it is alive while this holds the lock
+        std::lock_guard lock(m_lock);
+        if (m_stop)
+            return false;
+        m_rpc->post(std::move(body), [&](std::string_view reply, rpc_transport::response &&status) {
+            done.set_value(status.error.empty() && read(reply));
+        });
+    }
+    // every posted request completes, failed at the latest when the transport shuts down
+    return answered.get();
+}
+
+bool bitcoin_client::stopping() const
+{
+    std::lock_guard lock(m_lock);
+    return m_stop;
+}
+
+void bitcoin_client::submit_shares()
+{
+    std::vector<pending_share> batch;
+    std::unordered_set<std::uint64_t> seen;
+    std::deque<std::uint64_t> seen_order;
+    int failures = 0;
+
+    const auto take = [&](pending_share &&share) {
+        const auto key = share_key(share.unit);
+        if (!seen.insert(key).second) {
+            std::lock_guard lock(m_lock);
+            ++m_submitted.duplicates;
+            return;
+        }
+        seen_order.push_back(key);
+        if (seen_order.size() > DedupWindow) {
+            seen.erase(seen_order.front());
+            seen_order.pop_front();
+        }
+        batch.push_back(std::move(share));
+    };
+
+    while (!stopping()) {
+        // a batch still held here failed last time and is retried as it is, plus newcomers
+        if (batch.empty()) {
+            // timed: a freeze() landing before this wait starts must not strand the thread
+            if (auto share = m_shares.pop_for(std::chrono::milliseconds(250)))
+                take(std::move(*share));
+        }
+        while (batch.size() < MaxBatch) {
+            auto share = m_shares.try_pop();
+            if (!share)
+                break;
+            take(std::move(*share));
+        }
+        if (batch.empty())
+            continue;
+
+        if (send_batch(batch)) {
+            batch.clear();
+            failures = 0;
+            continue;
+        }
+
+        std::unique_lock lock(m_lock);
+        ++m_submitted.retries;
+        std::erase_if(batch, [this](pending_share &share) {
+            if (++share.attempts < MaxSubmitAttempts)
+                return false;
+            ++m_submitted.abandoned;
+            return true;
+        });
+        m_changed.wait_for(lock, backoff(++failures), [this] { return m_stop; });
+    }
+}
+
+bool bitcoin_client::send_batch(std::vector<pending_share> &batch)
+{
+    static constexpr std::string_view prefix = "{\"method\": \"getwork\", \"params\": [ \"";
+    static constexpr std::string_view suffix = "\" ], \"id\":";
+    char data[2 * sizeof(work::data)];
+    std::string request;
+
+    {
+        std::lock_guard lock(m_lock);
+        for (auto &share : batch)
+            share.stale = m_havePrevHash && std::memcmp(share.unit.data + PrevHashOffset, m_prevHash, sizeof(m_prevHash)) != 0;
+    }
+
+    request.reserve(batch.size() * (prefix.size() + sizeof(data) + suffix.size() + 8) + 2);
+    if (batch.size() > 1)
+        request += '[';
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        hex::encode_to(batch[i].unit.data, sizeof(batch[i].unit.data), data);
+        if (i)
+            request += ',';
+        request += prefix;
+        request.append(data, sizeof(data));
+        request += suffix;
+        request += std::to_string(i);
+        request += '}';
+    }
+    if (batch.size() > 1)
+        request += ']';
+
+    return exchange(std::move(request), [&](std::string_view reply) {
+        auto parsed = json::parse(reply);
+        if (!parsed || !(parsed->is_array() || parsed->is_object()))
+            return false;
+
+        // answers come back by id, a lone request is answered by a plain object
+        std::vector<bool> answered(batch.size());
+        const auto answers = parsed->is_array() ? std::span<const json::value>(parsed->as_array())
+                                                : std::span<const json::value>(&*parsed, 1);
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard lock(m_lock);
+        ++m_submitted.batches;
+        for (const auto &answer : answers) {
+            const auto id = answer["id"].as_int();
+            if (!answer["id"].is_number() || id < 0 || static_cast<std::size_t>(id) >= batch.size() || answered[id])
+                continue;
+            answered[id] = true;
+            const auto &share = batch[id];
+            const bool accepted = answer["error"].is_null() && answer["result"].as_bool();
+            ++(accepted ? m_submitted.accepted : m_submitted.rejected);
+            if (share.stale)
+                ++m_submitted.stale;
+            const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - share.found);
+            m_submitted.last_latency = latency;
+            m_submitted.max_latency = std::max(m_submitted.max_latency, latency);
+            m_submitted.total_latency += latency;
+        }
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            if (answered[i])
+                continue;
+            ++m_submitted.rejected;
+            if (batch[i].stale)
+                ++m_submitted.stale;
+        }
+        return true;
+    });
+}
+
+void bitcoin_client::prefetch()
+{
+    int failures = 0;
+    std::unique_lock lock(m_lock);
+    while (!m_stop) {
+        if (m_ready.size() >= m_depth) {
+            m_changed.wait(lock);
+            continue;
+        }
+        lock.unlock();
+
+        prefetched next;
+        const auto started = std::chrono::steady_clock::now();
+        const bool ok = exchange(std::string(GetworkRequest), [&](std::string_view reply) {
+            auto result = rpc_result(reply);
+            return !result.empty() && work_decode(result, &next.unit);
+        });
+        next.fetch_time = std::chrono::steady_clock::now() - started;
+
+        lock.lock();
+        if (!ok) {
+            if (m_stop)
+                break;
+            ++m_stats.failures;
+            // interruptible, so stopping never waits out a long backoff
+            m_changed.wait_for(lock, backoff(++failures), [this] { return m_stop; });
+            continue;
+        }
+        failures = 0;
+        ++m_stats.fetched;
+        std::memcpy(m_prevHash, next.unit.data + PrevHashOffset, sizeof(m_prevHash));
+        m_havePrevHash = true;
+        m_ready.push_back(next);
+        m_changed.notify_all();
+    }
+}
@@ -1,156 +1,163 @@
-/* 
+/*
  *       Copyright (C) 2022 ElectronRock - All Rights Reserved
  */
 
 #pragma once
 
-#include <curl/curl.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "rpc_transport.h"
+#include "target.h"
+#include "thread_queue.h"
 
 struct work {
     unsigned char	data[128];
     unsigned char	hash1[64];
     unsigned char	midstate[32];
     unsigned char	target[32];
+    crypto::target256	share_target;	/* 'target', converted once by work_decode */
 
     unsigned char	hash[32];
 };
 
-struct thr_info {
-    int		id;
-    pthread_t	pth;
-    struct thread_q	*q;
-};
-
-extern char *bin2hex(const unsigned char *p, size_t len);
-extern bool hex2bin(unsigned char *p, const char *hexstr, size_t len);
-extern json_t *json_rpc_call(CURL *curl, const char *url, const char *userpass,
-                             const char *rpc_req, bool, bool);
-
-static bool submit_upstream_work(CURL *curl, const struct work *work)
-{
-    char *hexstr = NULL;
-    json_t *val, *res;
-    char s[345];
-    bool rc = false;
-
-    /* build hex string */
-    hexstr = bin2hex(work->data, sizeof(work->data));
-    if (unlikely(!hexstr)) {
-        goto out;
-    }
-
-    /* build JSON-RPC request */
-    sprintf(s,
-            "{\"method\": \"getwork\", \"params\": [ \"%s\" ], \"id\":1}\r\n",
-            hexstr);
-
-
-    /* issue JSON-RPC request */
-    val = json_rpc_call(curl, rpc_url, rpc_userpass, s, false, false);
-    if (unlikely(!val)) {
-        goto out;
-    }
-
-    res = json_object_get(val, "result");
-
-
-    json_decref(val);
-
-    rc = true;
-
-    out:
-    free(hexstr);
-    return rc;
-}
-static const char *rpc_req =
-        "{\"method\": \"getwork\", \"params\": [], \"id\":0}\r\n";
-
-static bool jobj_binary(const json_t *obj, const char *key,
-                        void *buf, size_t buflen)
-{
-    const char *hexstr;
-    json_t *tmp;
-
-    tmp = json_object_get(obj, key);
-    if (unlikely(!tmp)) {
-        return false;
-    }
-    hexstr = json_string_value(tmp);
-    if (unlikely(!hexstr) || !hex2bin(buf, hexstr, buflen))) {
-        return false;
-    }
-    return true;
-}
-
-static bool work_decode(const json_t *val, struct work *work)
-{
-
-    if (unlikely(!jobj_binary(val, "midstate", work->midstate, sizeof(work->midstate))) ||
-            unlikely(!jobj_binary(val, "data", work->data, sizeof(work->data))) ||
-            unlikely(!jobj_binary(val, "hash1", work->hash1, sizeof(work->hash1))) ||
-            unlikely(!jobj_binary(val, "target", work->target, sizeof(work->target)))) {
-        return false;
-    }
-
-    memset(work->hash, 0, sizeof(work->hash));
-
-    return true;
-}
-
+/* 'val' is the raw text of the getwork result: only the four members are looked at */
+bool work_decode(std::string_view val, struct work *work);
+
+/*
+ * getwork client with a background prefetcher and an asynchronous share submitter.
+ *
+ * A fetch thread keeps up to `depth` decoded work units ready, so get_work() hands the miner
+ * its next job without a network round trip. Failed requests back off exponentially with
+ * jitter (see backoff) instead of sleeping a fixed 30 seconds.
+ *
+ * submit() only queues the share and returns, so the hashing thread resumes at once. A submit
+ * thread drops duplicates, sends whatever has queued up as one JSON-RPC batch and retries the
+ * batch with backoff while the node is unreachable.
+ *
+ * Both threads talk to the node through one rpc_transport with a connection each, so a slow
+ * getwork never holds up a submission. Replies are scanned in the connection's buffer, no DOM
+ * is built for a getwork reply.
+ */
 class bitcoin_client final {
-    static bool workio_get_work(work *wc, CURL *curl)
-    {
-        struct work *ret_work;
-        int failures = 0;
-
-        ret_work = new work;
-        if (!ret_work)
-            return false;
-
-        /* obtain new work from bitcoin via JSON-RPC */
-        while (!get_upstream_work(curl, ret_work)) {
-            if (unlikely((10 >= 0) && (++failures > 10))) {
-                free(ret_work);
-                return false;
-            }
-
-            /* pause, then restart work-request loop */
-            sleep(30);
+public:
+    struct prefetch_stats {
+        std::size_t depth = 0;                      // work units ready right now
+        std::uint64_t fetched = 0;                  // work units decoded by the fetch thread
+        std::uint64_t failures = 0;                 // failed getwork requests
+        std::uint64_t ready = 0;                    // get_work calls served from the queue
+        std::uint64_t waited = 0;                   // get_work calls that found the queue empty
+        std::chrono::nanoseconds idle_avoided { 0 };// fetch time of the work served from the queue
+        std::chrono::nanoseconds idle { 0 };        // time get_work spent waiting on an empty queue
+    };
+
+    struct submit_stats {
+        std::uint64_t queued = 0;                   // shares handed to submit()
+        std::uint64_t overflow = 0;                 // refused by submit(), the queue was full
+        std::uint64_t duplicates = 0;               // dropped as already submitted
+        std::uint64_t abandoned = 0;                // dropped after MaxSubmitAttempts failed exchanges
+        std::uint64_t accepted = 0;
+        std::uint64_t rejected = 0;                 // refused by the node, or left unanswered
+        std::uint64_t stale = 0;                    // sent after work on a newer block had arrived
+        std::uint64_t batches = 0;                  // requests that got a reply
+        std::uint64_t retries = 0;                  // failed exchanges
+        std::chrono::nanoseconds last_latency { 0 };// submit() until the node's answer
+        std::chrono::nanoseconds max_latency { 0 };
+        std::chrono::nanoseconds total_latency { 0 };
+
+        double stale_rate() const {
+            const auto answered = accepted + rejected;
+            return answered ? static_cast<double>(stale) / answered : 0;
         }
+    };
 
-        return true;
-    }
+    constexpr static std::size_t SubmitQueueSize = 256;
+    constexpr static std::size_t MaxBatch = 32;
+    constexpr static int MaxSubmitAttempts = 10;
 
-    static bool workio_submit_work(work	*wc, CURL *curl)
-    {
-        int failures = 0;
+    // userpass: "user:password" for HTTP basic authentication, empty for none
+    bitcoin_client(std::string url, std::string userpass, std::size_t depth = 2);
 
-        /* submit solution to bitcoin via JSON-RPC */
-        while (!submit_upstream_work(curl, wc)) {
-            if (unlikely((10 >= 0) && (++failures > 10))) {
-                return false;
-            }
+    // shares still queued or being retried are dropped
+    ~bitcoin_client();
 
-            sleep(30);
-        }
+    bitcoin_client(const bitcoin_client&) = delete;
+    bitcoin_client& operator=(const bitcoin_client&) = delete;
 
-        return true;
-    }
-private:
-    static bool get_upstream_work(CURL *curl, struct work *work)
-    {
-        json_t *val;
-        bool rc;
+    // the next ready work unit, waits for the fetch thread when none is; false once stopped
+    bool get_work(work *wc);
+
+    // drops the ready work, e.g. once a new block made it stale
+    void flush();
+
+    prefetch_stats stats() const;
 
-        val = json_rpc_call(curl, rpc_url, rpc_userpass, rpc_req,
-                            true, false);
-        if (!val)
-            return false;
+    // queues a solved work unit for the submit thread, never blocks; false when the queue is full
+    bool submit(const work &solved);
 
-        rc = work_decode(json_object_get(val, "result"), work);
+    submit_stats submissions() const;
 
-        json_decref(val);
+    /*
+     * Delay before retry number `failures` (from 1): 250 ms doubling up to 30 s, of which
+     * a random half is waited, so clients failing together do not retry in lockstep.
+     */
+    static std::chrono::milliseconds backoff(int failures);
 
-        return rc;
-    }
-};
\ No newline at end of file
+private:
+    struct prefetched {
+        work unit;
+        std::chrono::nanoseconds fetch_time;
+    };
+
+    // no member initializers: the queue needs it default-constructible inside this class
+    struct pending_share {
+        work unit;
+        std::chrono::steady_clock::time_point found;
+        int attempts;
+        bool stale;
+    };
+
+    // the fetch thread: tops the queue up to m_depth, backing off while the node fails
+    void prefetch();
+
+    // the submit thread: drains the queue into batches, one request per batch
+    void submit_shares();
+
+    // one request for the whole batch (a JSON-RPC batch when there is more than one share)
+    bool send_batch(std::vector<pending_share> &batch);
+
+    /*
+     * Posts `body` and waits for the reply, which `read` looks at on the transport's thread.
+     * False once stopping, when the exchange failed or when `read` found no sensible reply.
+     */
+    bool exchange(std::string body, const std::function<bool(std::string_view)> &read);
+
+    bool stopping() const;
+
+    const std::size_t m_depth;
+    mutable std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::deque<prefetched> m_ready;
+    prefetch_stats m_stats;
+    unsigned char m_prevHash[32] = {};              // of the latest work fetched, tells stale shares
+    bool m_havePrevHash = false;
+    submit_stats m_submitted;
+    std::atomic<std::uint64_t> m_queued { 0 };
+    std::atomic<std::uint64_t> m_overflow { 0 };
+    mpmc_queue<pending_share> m_shares { SubmitQueueSize };
+    bool m_stop = false;
+    std::unique_ptr<rpc_transport> m_rpc;           // reset first on destruction, failing what is in flight
+    // last: started once everything above exists
+    std::thread m_fetcher;
+    std::thread m_submitter;
+};
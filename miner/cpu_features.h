@@ -0,0 +1,60 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace crypto {
+
+    /*
+    * Instruction set extensions usable by the hashing backends.
+    * Detected once from CPUID; AVX flavours also require the OS to save the wider registers (XCR0).
+    */
+    struct cpu_features {
+        bool sse41 = false;
+        bool avx2 = false;
+        bool avx512f = false;
+        bool sha = false;
+
+        static const cpu_features& get() {
+            static const cpu_features features = detect();
+            return features;
+        }
+
+    private:
+        static cpu_features detect() {
+            cpu_features result;
+#if defined(__x86_64__) || defined(__i386__)
+            unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+            if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                return result;
+
+            result.sse41 = (ecx & bit_SSE4_1) != 0;
+            const bool osxsave = (ecx & bit_OSXSAVE) != 0;
+            const bool avx = (ecx & bit_AVX) != 0;
+
+            unsigned long long xcr0 = 0;
+            if(osxsave) {
+                unsigned lo = 0, hi = 0;
+                __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+                xcr0 = (static_cast<unsigned long long>(hi) << 32) | lo;
+            }
+            const bool ymm_state = (xcr0 & 0x06) == 0x06;
+            const bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+
+            if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+                return result;
+
+            result.avx2 = avx && ymm_state && (ebx & bit_AVX2) != 0;
+            result.avx512f = zmm_state && (ebx & bit_AVX512F) != 0;
+            result.sha = result.sse41 && (ebx & bit_SHA) != 0;
+#endif
+            return result;
+        }
+    };
+
+}
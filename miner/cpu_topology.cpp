@@ -0,0 +1,148 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+    constexpr unsigned MaxNodes = 1024;
+
+#if defined(__linux__)
+    std::vector<unsigned> allowed_cpus() {
+        std::vector<unsigned> result;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if(sched_getaffinity(0, sizeof(set), &set) != 0)
+            return result;
+        for(unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if(CPU_ISSET(cpu, &set))
+                result.push_back(cpu);
+        return result;
+    }
+
+    bool read_line(const std::string& path, std::string& line) {
+        std::ifstream file(path);
+        return file && std::getline(file, line);
+    }
+#endif
+
+}
+
+unsigned cpu_topology::cpu_count() const {
+    unsigned count = 0;
+    for(const auto& node : nodes)
+        count += static_cast<unsigned>(node.size());
+    return count;
+}
+
+const cpu_topology& cpu_topology::get() {
+    static const cpu_topology topology = detect();
+    return topology;
+}
+
+bool cpu_topology::pin_current_thread(unsigned cpu) {
+#if defined(__linux__)
+    if(cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+bool cpu_topology::pin_current_thread(const std::vector<unsigned>& cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto cpu : cpus)
+        if(cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    if(CPU_COUNT(&set) == 0)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+std::vector<unsigned> cpu_topology::parse_cpulist(const char* list) {
+    std::vector<unsigned> result;
+    const char* p = list;
+    while(*p) {
+        char* end = nullptr;
+        auto first = std::strtoul(p, &end, 10);
+        if(end == p)
+            break;
+        auto last = first;
+        p = end;
+        if(*p == '-') {
+            last = std::strtoul(p + 1, &end, 10);
+            if(end == p + 1)
+                break;
+            p = end;
+        }
+        for(auto cpu = first; cpu <= last; ++cpu)
+            result.push_back(static_cast<unsigned>(cpu));
+        if(*p != ',')
+            break;
+        ++p;
+    }
+    return result;
+}
+
+cpu_topology cpu_topology::detect() {
+    cpu_topology result;
+#if defined(__linux__)
+    auto allowed = allowed_cpus();
+    std::string line;
+    std::vector<unsigned> placed;
+    for(unsigned node = 0; node < MaxNodes && !allowed.empty(); ++node) {
+        if(!read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", line))
+            continue;
+        std::vector<unsigned> cpus;
+        for(auto cpu : parse_cpulist(line.c_str()))
+            if(std::binary_search(allowed.begin(), allowed.end(), cpu))
+                cpus.push_back(cpu);
+        if(cpus.empty())
+            continue;
+        placed.insert(placed.end(), cpus.begin(), cpus.end());
+        result.nodes.push_back(std::move(cpus));
+    }
+
+    // no sysfs node information (containers, non-NUMA kernels): one node of the allowed CPUs
+    std::sort(placed.begin(), placed.end());
+    std::vector<unsigned> rest;
+    std::set_difference(allowed.begin(), allowed.end(), placed.begin(), placed.end(), std::back_inserter(rest));
+    if(!rest.empty()) {
+        if(result.nodes.empty())
+            result.nodes.push_back(std::move(rest));
+        else
+            result.nodes.front().insert(result.nodes.front().end(), rest.begin(), rest.end());
+    }
+#endif
+    if(result.nodes.empty()) {
+        std::vector<unsigned> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+        for(unsigned cpu = 0; cpu < cpus.size(); ++cpu)
+            cpus[cpu] = cpu;
+        result.nodes.push_back(std::move(cpus));
+    }
+    return result;
+}
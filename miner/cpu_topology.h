@@ -0,0 +1,33 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <vector>
+
+/*
+ * CPUs this process may run on, grouped by NUMA node.
+ * On Linux the nodes come from sysfs (/sys/devices/system/node) restricted to the affinity mask,
+ * so taskset / cgroup limits are honoured; elsewhere there is one node of hardware_concurrency() CPUs.
+ */
+struct cpu_topology {
+    // allowed CPU ids of every node that has at least one of them
+    std::vector<std::vector<unsigned>> nodes;
+
+    unsigned cpu_count() const;
+
+    static const cpu_topology& get();
+
+    // binds the calling thread to one CPU, false where unsupported or refused
+    static bool pin_current_thread(unsigned cpu);
+
+    // binds the calling thread to a set of CPUs (e.g. one node's), false where unsupported or refused
+    static bool pin_current_thread(const std::vector<unsigned>& cpus);
+
+    // parses a sysfs cpulist such as "0-3,8,10-11"
+    static std::vector<unsigned> parse_cpulist(const char* list);
+
+private:
+    static cpu_topology detect();
+};
@@ -0,0 +1,93 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "sha256_inline.h"
+#include "sha256_shani.h"
+
+namespace crypto {
+
+    /*
+    * Double SHA-256 of an 80-byte block header with a cached midstate.
+    *
+    * The first 64 bytes of the header never change within a job, so their compression
+    * is done once in the constructor (or in reset()). Per nonce only the padded second
+    * block and the padded 32-byte second hash are compressed, 2 transforms instead of 3.
+    *
+    * The nonce is stored at header bytes 76..79 in host byte order, the same way
+    * the work function used to patch header_t directly.
+    *
+    * @param Sha256 hashing policy with the crypto::sha256 member functions (update/transform/state),
+    * has to be copyable: the copy is the midstate snapshot. The default is free of allocations and
+    * virtual calls and uses the SHA extensions when the CPU has them, but it goes through
+    * shani_transform's function pointer once per block. Hot loops take the policy from
+    * crypto::dispatch_transform instead, e.g.
+    *   dispatch_transform([&](auto kernel) {
+    *       header_hasher<basic_sha256<typename decltype(kernel)::type>> hasher(header); ... });
+    */
+    template<typename Sha256 = basic_sha256<shani_transform>>
+    class header_hasher final {
+    public:
+        using header_t = std::array<unsigned char, 80>;
+        using block_t = std::array<unsigned char, 64>;
+        using hash_t = sha256::hash_t;
+
+        explicit header_hasher(const header_t& header) {
+            reset(header);
+        }
+
+        void reset(const header_t& header) {
+            m_midstate = Sha256{};
+            m_midstate.transform(header.data());
+            reset_tail(header);
+        }
+
+        // only header bytes 64..79 (merkle root tail, ntime, nbits) changed: keeps the midstate
+        void reset_tail(const header_t& header) {
+            m_tail = padded_block(80);
+            std::memcpy(m_tail.data(), header.data() + 64, 16);
+        }
+
+        // chaining value after the first 64 header bytes
+        hash_t midstate() const {
+            return m_midstate.state();
+        }
+
+        hash_t compute(std::uint32_t nonce) const {
+            auto block = m_tail;
+            std::memcpy(block.data() + 12, &nonce, sizeof(nonce));
+
+            Sha256 first(m_midstate);
+            first.transform(block.data());
+
+            block = padded_block(32);
+            auto hash1 = first.state();
+            std::memcpy(block.data(), hash1.data(), hash1.size());
+
+            Sha256 second;
+            second.transform(block.data());
+            return second.state();
+        }
+
+    private:
+        // last block of a message of the given length, data bytes left zeroed
+        static block_t padded_block(std::uint64_t message_length) {
+            block_t block = {0};
+            block[message_length % 64] = 0x80;
+            auto bits = message_length * 8;
+            for(unsigned i = 0; i < 8; ++i)
+                block[63 - i] = static_cast<unsigned char>(bits >> (i * 8));
+            return block;
+        }
+
+        Sha256 m_midstate;
+        block_t m_tail;
+    };
+
+}
@@ -0,0 +1,138 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Allocation-free hex codec: lookup tables per byte, 16 bytes (32 digits) per step with SSE2
+ * wherever the target has it (always on x86-64, so no runtime dispatch is needed).
+ */
+namespace hex {
+
+    namespace detail {
+
+        // "00" .. "ff", two digits per byte value
+        constexpr auto pairs = [] {
+            constexpr char digits[] = "0123456789abcdef";
+            std::array<char, 512> table {};
+            for(unsigned i = 0; i < 256; ++i) {
+                table[2 * i] = digits[i >> 4];
+                table[2 * i + 1] = digits[i & 0x0f];
+            }
+            return table;
+        }();
+
+        // digit value per character, -1 for anything that is not a hex digit
+        constexpr auto values = [] {
+            std::array<signed char, 256> table {};
+            for(int c = 0; c < 256; ++c)
+                table[c] = static_cast<signed char>(c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1);
+            return table;
+        }();
+
+#if defined(__SSE2__)
+        // 16 bytes to 32 lowercase digits
+        inline void encode16(const unsigned char* data, char* out) {
+            const auto low_nibbles = _mm_set1_epi8(0x0f);
+            const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            const auto high = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibbles);
+            const auto low = _mm_and_si128(bytes, low_nibbles);
+            // '0' + n, plus the gap up to 'a' for n > 9
+            const auto ascii = [](__m128i nibbles) {
+                const auto letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+                return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+            };
+            const auto high_digits = ascii(high), low_digits = ascii(low);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(high_digits, low_digits));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(high_digits, low_digits));
+        }
+
+        // digit values of 16 characters, false when any is not a hex digit
+        inline bool nibbles16(const char* text, __m128i& out) {
+            const auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text));
+            // signed compares: bytes >= 0x80 are negative and fail every range
+            const auto in = [](__m128i v, char first, char last) {
+                return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(first - 1))),
+                                     _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(last + 1))));
+            };
+            const auto lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+            const auto is_digit = in(chars, '0', '9');
+            const auto is_letter = in(lower, 'a', 'f');
+            out = _mm_or_si128(_mm_and_si128(is_digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+                               _mm_and_si128(is_letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+            return _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) == 0xffff;
+        }
+
+        // 32 digits to 16 bytes
+        inline bool decode16(const char* text, unsigned char* out) {
+            __m128i first, second;
+            if(!nibbles16(text, first) || !nibbles16(text + 16, second))
+                return false;
+            // every 16-bit lane holds a high digit in its low byte and a low digit in its high byte
+            const auto combine = [](__m128i nibbles) {
+                const auto high = _mm_and_si128(nibbles, _mm_set1_epi16(0x00ff));
+                return _mm_or_si128(_mm_slli_epi16(high, 4), _mm_srli_epi16(nibbles, 8));
+            };
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(combine(first), combine(second)));
+            return true;
+        }
+#endif
+
+    }
+
+    // lowercase hex of `length` bytes into `out`, exactly 2 * length characters and no terminator
+    inline void encode_to(const unsigned char* data, std::size_t length, char* out) {
+        const auto end = data + length;
+#if defined(__SSE2__)
+        for(; end - data >= 16; data += 16, out += 32)
+            detail::encode16(data, out);
+#endif
+        for(; data != end; ++data, out += 2) {
+            out[0] = detail::pairs[2 * *data];
+            out[1] = detail::pairs[2 * *data + 1];
+        }
+    }
+
+    // lowercase hex of `length` bytes
+    inline std::string encode(const unsigned char* data, std::size_t length) {
+        std::string result(length * 2, '\0');
+        encode_to(data, length, result.data());
+        return result;
+    }
+
+    // value of one hex digit, -1 for anything else
+    inline int digit(char c) {
+        return detail::values[static_cast<unsigned char>(c)];
+    }
+
+    // decodes exactly `length` bytes; false on a length mismatch or a non-hex digit
+    inline bool decode(std::string_view text, unsigned char* out, std::size_t length) {
+        if(text.size() != length * 2)
+            return false;
+        const char* digits = text.data();
+        const auto end = out + length;
+#if defined(__SSE2__)
+        for(; end - out >= 16; digits += 32, out += 16)
+            if(!detail::decode16(digits, out))
+                return false;
+#endif
+        for(; out != end; digits += 2, ++out) {
+            int high = digit(digits[0]), low = digit(digits[1]);
+            if(high < 0 || low < 0)
+                return false;
+            *out = static_cast<unsigned char>(high << 4 | low);
+        }
+        return true;
+    }
+
+}
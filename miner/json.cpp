@@ -0,0 +1,428 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "json.h"
+
+#include <charconv>
+#include <cmath>
+
+namespace json {
+
+    namespace {
+
+        constexpr unsigned MaxDepth = 64;
+
+        const value null_value;
+        const std::string empty_string;
+        const array empty_array;
+        const object empty_object;
+
+        class parser {
+        public:
+            explicit parser(std::string_view text) : m_text(text) {}
+
+            std::optional<value> document() {
+                auto result = parse_value(0);
+                skip_space();
+                if(!result || m_pos != m_text.size())
+                    return std::nullopt;
+                return result;
+            }
+
+        private:
+            void skip_space() {
+                while(m_pos < m_text.size() && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t'
+                                                 || m_text[m_pos] == '\n' || m_text[m_pos] == '\r'))
+                    ++m_pos;
+            }
+
+            bool consume(std::string_view token) {
+                if(m_text.substr(m_pos, token.size()) != token)
+                    return false;
+                m_pos += token.size();
+                return true;
+            }
+
+            std::optional<value> parse_value(unsigned depth) {
+                skip_space();
+                if(m_pos >= m_text.size() || depth > MaxDepth)
+                    return std::nullopt;
+                switch(m_text[m_pos]) {
+                    case '{':
+                        return parse_object(depth);
+                    case '[':
+                        return parse_array(depth);
+                    case '"': {
+                        auto text = parse_string();
+                        if(!text)
+                            return std::nullopt;
+                        return value(std::move(*text));
+                    }
+                    case 't':
+                        return consume("true") ? std::optional<value>(true) : std::nullopt;
+                    case 'f':
+                        return consume("false") ? std::optional<value>(false) : std::nullopt;
+                    case 'n':
+                        return consume("null") ? std::optional<value>(nullptr) : std::nullopt;
+                    default:
+                        return parse_number();
+                }
+            }
+
+            std::optional<value> parse_number() {
+                const char* first = m_text.data() + m_pos;
+                const char* last = m_text.data() + m_text.size();
+                double number = 0;
+                auto [end, error] = std::from_chars(first, last, number);
+                if(error != std::errc() || !std::isfinite(number))
+                    return std::nullopt;
+                m_pos += end - first;
+                return value(number);
+            }
+
+            static void append_utf8(std::string& out, std::uint32_t code) {
+                if(code < 0x80) {
+                    out += static_cast<char>(code);
+                } else if(code < 0x800) {
+                    out += static_cast<char>(0xc0 | code >> 6);
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                } else if(code < 0x10000) {
+                    out += static_cast<char>(0xe0 | code >> 12);
+                    out += static_cast<char>(0x80 | (code >> 6 & 0x3f));
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                } else {
+                    out += static_cast<char>(0xf0 | code >> 18);
+                    out += static_cast<char>(0x80 | (code >> 12 & 0x3f));
+                    out += static_cast<char>(0x80 | (code >> 6 & 0x3f));
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                }
+            }
+
+            std::optional<std::uint32_t> parse_code_unit() {
+                if(m_text.size() - m_pos < 4)
+                    return std::nullopt;
+                std::uint32_t code = 0;
+                auto [end, error] = std::from_chars(m_text.data() + m_pos, m_text.data() + m_pos + 4, code, 16);
+                if(error != std::errc() || end != m_text.data() + m_pos + 4)
+                    return std::nullopt;
+                m_pos += 4;
+                return code;
+            }
+
+            std::optional<std::string> parse_string() {
+                ++m_pos; // opening quote
+                std::string result;
+                while(m_pos < m_text.size()) {
+                    char c = m_text[m_pos++];
+                    if(c == '"')
+                        return result;
+                    if(static_cast<unsigned char>(c) < 0x20)
+                        return std::nullopt;
+                    if(c != '\\') {
+                        result += c;
+                        continue;
+                    }
+                    if(m_pos >= m_text.size())
+                        return std::nullopt;
+                    switch(m_text[m_pos++]) {
+                        case '"': result += '"'; break;
+                        case '\\': result += '\\'; break;
+                        case '/': result += '/'; break;
+                        case 'b': result += '\b'; break;
+                        case 'f': result += '\f'; break;
+                        case 'n': result += '\n'; break;
+                        case 'r': result += '\r'; break;
+                        case 't': result += '\t'; break;
+                        case 'u': {
+                            auto code = parse_code_unit();
+                            if(!code)
+                                return std::nullopt;
+                            if(*code >= 0xd800 && *code < 0xdc00) {
+                                if(!consume("\\u"))
+                                    return std::nullopt;
+                                auto low = parse_code_unit();
+                                if(!low || *low < 0xdc00 || *low >= 0xe000)
+                                    return std::nullopt;
+                                *code = 0x10000 + ((*code - 0xd800) << 10) + (*low - 0xdc00);
+                            }
+                            append_utf8(result, *code);
+                            break;
+                        }
+                        default:
+                            return std::nullopt;
+                    }
+                }
+                return std::nullopt;
+            }
+
+            std::optional<value> parse_array(unsigned depth) {
+                ++m_pos;
+                array result;
+                skip_space();
+                if(consume("]"))
+                    return value(std::move(result));
+                for(;;) {
+                    auto element = parse_value(depth + 1);
+                    if(!element)
+                        return std::nullopt;
+                    result.push_back(std::move(*element));
+                    skip_space();
+                    if(consume("]"))
+                        return value(std::move(result));
+                    if(!consume(","))
+                        return std::nullopt;
+                }
+            }
+
+            std::optional<value> parse_object(unsigned depth) {
+                ++m_pos;
+                object result;
+                skip_space();
+                if(consume("}"))
+                    return value(std::move(result));
+                for(;;) {
+                    skip_space();
+                    if(m_pos >= m_text.size() || m_text[m_pos] != '"')
+                        return std::nullopt;
+                    auto key = parse_string();
+                    skip_space();
+                    if(!key || !consume(":"))
+                        return std::nullopt;
+                    auto member = parse_value(depth + 1);
+                    if(!member)
+                        return std::nullopt;
+                    result.emplace_back(std::move(*key), std::move(*member));
+                    skip_space();
+                    if(consume("}"))
+                        return value(std::move(result));
+                    if(!consume(","))
+                        return std::nullopt;
+                }
+            }
+
+            std::string_view m_text;
+            std::size_t m_pos = 0;
+        };
+
+        // the parser's grammar, only stepping over values and remembering where they were
+        class scanner {
+        public:
+            explicit scanner(std::string_view text) : m_text(text) {}
+
+            bool object(std::span<const std::string_view> keys, std::span<std::string_view> values) {
+                skip_space();
+                if(!consume('{'))
+                    return false;
+                skip_space();
+                if(!consume('}')) {
+                    for(;;) {
+                        skip_space();
+                        auto key = string();
+                        skip_space();
+                        if(!key || !consume(':'))
+                            return false;
+                        skip_space();
+                        const auto first = m_pos;
+                        if(!value(0))
+                            return false;
+                        // keys are compared as written, escapes in them never match
+                        for(std::size_t i = 0; i < keys.size() && i < values.size(); ++i)
+                            if(*key == keys[i])
+                                values[i] = m_text.substr(first, m_pos - first);
+                        skip_space();
+                        if(consume('}'))
+                            break;
+                        if(!consume(','))
+                            return false;
+                    }
+                }
+                skip_space();
+                return m_pos == m_text.size();
+            }
+
+        private:
+            void skip_space() {
+                while(m_pos < m_text.size() && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t'
+                                                 || m_text[m_pos] == '\n' || m_text[m_pos] == '\r'))
+                    ++m_pos;
+            }
+
+            bool consume(char c) {
+                if(m_pos >= m_text.size() || m_text[m_pos] != c)
+                    return false;
+                ++m_pos;
+                return true;
+            }
+
+            bool consume(std::string_view token) {
+                if(m_text.substr(m_pos, token.size()) != token)
+                    return false;
+                m_pos += token.size();
+                return true;
+            }
+
+            // the raw contents between the quotes
+            std::optional<std::string_view> string() {
+                if(!consume('"'))
+                    return std::nullopt;
+                const auto first = m_pos;
+                while(m_pos < m_text.size()) {
+                    char c = m_text[m_pos++];
+                    if(c == '"')
+                        return m_text.substr(first, m_pos - 1 - first);
+                    if(static_cast<unsigned char>(c) < 0x20)
+                        return std::nullopt;
+                    if(c == '\\' && m_pos++ >= m_text.size())
+                        return std::nullopt;
+                }
+                return std::nullopt;
+            }
+
+            bool value(unsigned depth) {
+                skip_space();
+                if(m_pos >= m_text.size() || depth > MaxDepth)
+                    return false;
+                switch(m_text[m_pos]) {
+                    case '{':
+                    case '[':
+                        return container(depth);
+                    case '"':
+                        return string().has_value();
+                    case 't':
+                        return consume("true");
+                    case 'f':
+                        return consume("false");
+                    case 'n':
+                        return consume("null");
+                    default: {
+                        const char* first = m_text.data() + m_pos;
+                        double number;
+                        auto [end, error] = std::from_chars(first, m_text.data() + m_text.size(), number);
+                        m_pos += end - first;
+                        return error == std::errc();
+                    }
+                }
+            }
+
+            bool container(unsigned depth) {
+                const bool is_object = m_text[m_pos++] == '{';
+                const char close = is_object ? '}' : ']';
+                skip_space();
+                if(consume(close))
+                    return true;
+                for(;;) {
+                    skip_space();
+                    if(is_object) {
+                        if(!string())
+                            return false;
+                        skip_space();
+                        if(!consume(':'))
+                            return false;
+                    }
+                    if(!value(depth + 1))
+                        return false;
+                    skip_space();
+                    if(consume(close))
+                        return true;
+                    if(!consume(','))
+                        return false;
+                }
+            }
+
+            std::string_view m_text;
+            std::size_t m_pos = 0;
+        };
+
+    }
+
+    bool value::as_bool() const {
+        auto v = std::get_if<bool>(&m_value);
+        return v && *v;
+    }
+
+    double value::as_number() const {
+        auto v = std::get_if<double>(&m_value);
+        return v ? *v : 0;
+    }
+
+    std::int64_t value::as_int() const {
+        return static_cast<std::int64_t>(as_number());
+    }
+
+    const std::string& value::as_string() const {
+        auto v = std::get_if<std::string>(&m_value);
+        return v ? *v : empty_string;
+    }
+
+    const array& value::as_array() const {
+        auto v = std::get_if<array>(&m_value);
+        return v ? *v : empty_array;
+    }
+
+    const object& value::as_object() const {
+        auto v = std::get_if<object>(&m_value);
+        return v ? *v : empty_object;
+    }
+
+    const value* value::find(std::string_view key) const {
+        for(const auto& [name, member] : as_object())
+            if(name == key)
+                return &member;
+        return nullptr;
+    }
+
+    const value& value::operator[](std::string_view key) const {
+        auto member = find(key);
+        return member ? *member : null_value;
+    }
+
+    const value& value::operator[](std::size_t index) const {
+        const auto& elements = as_array();
+        return index < elements.size() ? elements[index] : null_value;
+    }
+
+    std::optional<value> parse(std::string_view text) {
+        return parser(text).document();
+    }
+
+    std::string quote(std::string_view text) {
+        constexpr char digits[] = "0123456789abcdef";
+        std::string result;
+        result.reserve(text.size() + 2);
+        result += '"';
+        for(char c : text) {
+            switch(c) {
+                case '"': result += "\\\""; break;
+                case '\\': result += "\\\\"; break;
+                case '\n': result += "\\n"; break;
+                case '\r': result += "\\r"; break;
+                case '\t': result += "\\t"; break;
+                default:
+                    if(static_cast<unsigned char>(c) < 0x20) {
+                        result += "\\u00";
+                        result += digits[c >> 4];
+                        result += digits[c & 0x0f];
+                    } else {
+                        result += c;
+                    }
+            }
+        }
+        result += '"';
+        return result;
+    }
+
+    bool scan_object(std::string_view text, std::span<const std::string_view> keys, std::span<std::string_view> values) {
+        return scanner(text).object(keys, values);
+    }
+
+    std::optional<std::string_view> raw_string(std::string_view raw) {
+        if(raw.size() < 2 || raw.front() != '"' || raw.back() != '"')
+            return std::nullopt;
+        raw = raw.substr(1, raw.size() - 2);
+        if(raw.find('\\') != std::string_view::npos)
+            return std::nullopt;
+        return raw;
+    }
+
+}
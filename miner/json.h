@@ -0,0 +1,81 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/*
+ * Minimal JSON document for the pool protocols (Stratum lines, getblocktemplate replies).
+ *
+ * Objects keep their members in document order; numbers are doubles, which holds every
+ * integer the protocols use (amounts, heights, ids) exactly.
+ */
+namespace json {
+
+    class value;
+    using array = std::vector<value>;
+    using object = std::vector<std::pair<std::string, value>>;
+
+    class value {
+    public:
+        value() = default;
+        value(std::nullptr_t) {}
+        value(bool v) : m_value(v) {}
+        value(double v) : m_value(v) {}
+        value(std::string v) : m_value(std::move(v)) {}
+        value(array v) : m_value(std::move(v)) {}
+        value(object v) : m_value(std::move(v)) {}
+
+        bool is_null() const { return std::holds_alternative<std::nullptr_t>(m_value); }
+        bool is_bool() const { return std::holds_alternative<bool>(m_value); }
+        bool is_number() const { return std::holds_alternative<double>(m_value); }
+        bool is_string() const { return std::holds_alternative<std::string>(m_value); }
+        bool is_array() const { return std::holds_alternative<array>(m_value); }
+        bool is_object() const { return std::holds_alternative<object>(m_value); }
+
+        // typed accessors, a default value when the type does not match
+        bool as_bool() const;
+        double as_number() const;
+        std::int64_t as_int() const;
+        const std::string& as_string() const;
+        const array& as_array() const;
+        const object& as_object() const;
+
+        // member of an object, nullptr when missing or not an object
+        const value* find(std::string_view key) const;
+
+        // member / element, null when missing
+        const value& operator[](std::string_view key) const;
+        const value& operator[](std::size_t index) const;
+
+    private:
+        std::variant<std::nullptr_t, bool, double, std::string, array, object> m_value;
+    };
+
+    // whole document, std::nullopt on malformed input or trailing garbage
+    std::optional<value> parse(std::string_view text);
+
+    // `text` as a quoted, escaped JSON string literal
+    std::string quote(std::string_view text);
+
+    /*
+    * Targeted lookup for hot replies: the raw text of the members `keys` of the object `text`,
+    * found in one pass that validates the structure but builds no document and copies nothing.
+    * values[i] is left empty when keys[i] is missing; false when `text` is not one object.
+    */
+    bool scan_object(std::string_view text, std::span<const std::string_view> keys, std::span<std::string_view> values);
+
+    // contents of the raw string literal `raw` when it needs no unescaping (hex, ids), std::nullopt otherwise
+    std::optional<std::string_view> raw_string(std::string_view raw);
+
+}
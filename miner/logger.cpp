@@ -0,0 +1,400 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "logger.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace logging::detail {
+
+    std::atomic<int> threshold { debug };
+
+}
+
+namespace {
+
+    using logging::detail::record;
+
+    constexpr std::size_t CacheLine = 64;
+    constexpr std::size_t RingSize = 64 * 1024;     // per thread, a power of two
+    constexpr std::size_t OutputChunk = 64 * 1024;
+    constexpr auto FlushInterval = std::chrono::milliseconds(20);
+
+    static_assert(RingSize >= 2 * logging::detail::MaxRecord && (RingSize & (RingSize - 1)) == 0);
+
+    /*
+    * Records of one thread: written by that thread alone and read by the logger thread alone.
+    * A record never wraps around the end of the ring; the space left there is skipped with a
+    * padding header (size and a negative priority, the 8 bytes every gap has at least).
+    */
+    class thread_ring {
+    public:
+        // producer side
+        std::byte* reserve(std::size_t size) {
+            size = logging::detail::aligned(size);
+            const auto tail = m_tail.load(std::memory_order::relaxed);
+            const auto offset = tail & (RingSize - 1);
+            const auto contiguous = RingSize - offset;
+            const auto needed = size <= contiguous ? size : contiguous + size;
+            if(tail + needed - m_headCache > RingSize) {
+                m_headCache = m_head.load(std::memory_order::acquire);
+                if(tail + needed - m_headCache > RingSize) {
+                    m_dropped.store(m_dropped.load(std::memory_order::relaxed) + 1, std::memory_order::relaxed);
+                    return nullptr;
+                }
+            }
+            m_reserved = needed;
+            if(size <= contiguous)
+                return m_data.get() + offset;
+            const auto padding = static_cast<std::uint32_t>(contiguous);
+            const std::int32_t skip = -1;
+            std::memcpy(m_data.get() + offset, &padding, sizeof(padding));
+            std::memcpy(m_data.get() + offset + sizeof(padding), &skip, sizeof(skip));
+            return m_data.get();
+        }
+
+        void commit() {
+            m_tail.store(m_tail.load(std::memory_order::relaxed) + m_reserved, std::memory_order::release);
+        }
+
+        void retire() {
+            m_retired.store(true, std::memory_order::release);
+        }
+
+        // consumer side: the oldest record, nullptr when empty
+        const record* front() {
+            auto head = m_head.load(std::memory_order::relaxed);
+            while(head != m_tail.load(std::memory_order::acquire)) {
+                const auto at = m_data.get() + (head & (RingSize - 1));
+                std::uint32_t size;
+                std::int32_t priority;
+                std::memcpy(&size, at, sizeof(size));
+                std::memcpy(&priority, at + sizeof(size), sizeof(priority));
+                if(priority >= 0)
+                    return reinterpret_cast<const record*>(at);
+                head += size;
+                m_head.store(head, std::memory_order::release);
+            }
+            return nullptr;
+        }
+
+        void pop(const record& front) {
+            m_head.store(m_head.load(std::memory_order::relaxed) + front.size, std::memory_order::release);
+        }
+
+        // the owning thread has exited, so nothing is written any more
+        bool retired() const {
+            return m_retired.load(std::memory_order::acquire);
+        }
+
+        std::uint64_t dropped() const {
+            return m_dropped.load(std::memory_order::relaxed);
+        }
+
+    private:
+        const std::unique_ptr<std::byte[]> m_data { new std::byte[RingSize] };
+        // producer side
+        alignas(CacheLine) std::atomic<std::size_t> m_tail { 0 };
+        std::size_t m_headCache { 0 };
+        std::size_t m_reserved { 0 };       // advance of the pending record, padding included
+        std::atomic<std::uint64_t> m_dropped { 0 };
+        // consumer side
+        alignas(CacheLine) std::atomic<std::size_t> m_head { 0 };
+        std::atomic_bool m_retired { false };
+    };
+
+    /*
+    * The logger thread. It wakes every FlushInterval (or on flush()), merges the records of
+    * all rings by time, formats them into one buffer and writes that with a single fwrite.
+    */
+    class backend {
+    public:
+        // never destroyed: threads may still log while statics are torn down
+        static backend& instance() {
+            static backend* const logger = [] {
+                auto created = new backend;
+                std::atexit([] { instance().shutdown(); });
+                return created;
+            }();
+            return *logger;
+        }
+
+        std::shared_ptr<thread_ring> attach() {
+            auto ring = std::make_shared<thread_ring>();
+            std::lock_guard lock(m_lock);
+            m_rings.push_back(ring);
+            return ring;
+        }
+
+        void set_output(std::FILE* output) {
+            std::lock_guard lock(m_lock);
+            m_output = output;
+        }
+
+        void flush() {
+            std::unique_lock lock(m_lock);
+            if(m_stopped)
+                return;
+            const auto target = ++m_flushRequested;
+            m_wake.notify_one();
+            m_flushedWake.wait(lock, [&] { return m_flushed >= target || m_stopped; });
+        }
+
+        std::uint64_t dropped() {
+            std::lock_guard lock(m_lock);
+            auto total = m_retiredDropped;
+            for(auto&& ring : m_rings)
+                total += ring->dropped();
+            return total;
+        }
+
+    private:
+        backend() {
+            m_thread = std::thread([this] { run(); });
+        }
+
+        void run() {
+            std::unique_lock lock(m_lock);
+            while(!m_stop) {
+                const auto requested = m_flushRequested;
+                lock.unlock();
+                drain();
+                lock.lock();
+                m_flushed = requested;
+                m_flushedWake.notify_all();
+                if(m_flushRequested == requested && !m_stop)
+                    m_wake.wait_for(lock, FlushInterval);
+            }
+            lock.unlock();
+            drain();
+        }
+
+        void shutdown() {
+            {
+                std::lock_guard lock(m_lock);
+                m_stop = true;
+            }
+            m_wake.notify_one();
+            if(m_thread.joinable())
+                m_thread.join();
+            std::lock_guard lock(m_lock);
+            m_stopped = true;
+            m_flushedWake.notify_all();
+        }
+
+        // writes out everything queued so far
+        void drain() {
+            std::FILE* output;
+            {
+                std::lock_guard lock(m_lock);
+                m_active.assign(m_rings.begin(), m_rings.end());
+                output = m_output;
+            }
+
+            for(;;) {
+                thread_ring* oldest = nullptr;
+                const record* next = nullptr;
+                for(auto&& ring : m_active)
+                    if(auto front = ring->front(); front && (!next || front->time < next->time)) {
+                        oldest = ring.get();
+                        next = front;
+                    }
+                if(!next)
+                    break;
+                emit(*next);
+                oldest->pop(*next);
+                if(m_text.size() >= OutputChunk)
+                    write(output);
+            }
+
+            std::uint64_t total = 0;
+            {
+                std::lock_guard lock(m_lock);
+                // a retired ring was drained above after its last commit
+                std::erase_if(m_rings, [this](const std::shared_ptr<thread_ring>& ring) {
+                    if(!ring->retired() || ring->front())
+                        return false;
+                    m_retiredDropped += ring->dropped();
+                    return true;
+                });
+                total = m_retiredDropped;
+                for(auto&& ring : m_rings)
+                    total += ring->dropped();
+            }
+            m_active.clear();
+            if(total > m_reportedDropped) {
+                append_line(stamp(logging::detail::now()), "log records dropped: ");
+                m_text.append(std::to_string(total - m_reportedDropped)).push_back('\n');
+                m_reportedDropped = total;
+            }
+            write(output);
+        }
+
+        void emit(const record& entry) {
+            const auto payload = reinterpret_cast<const std::byte*>(&entry + 1);
+            if(!entry.format) {
+                append_line(stamp(entry.time), reinterpret_cast<const char*>(payload));
+                m_text.push_back('\n');
+                return;
+            }
+            int length = entry.format_payload(m_scratch.data(), m_scratch.size(), entry.format, payload);
+            if(length < 0)
+                return;
+            if(static_cast<std::size_t>(length) >= m_scratch.size()) {
+                m_scratch.resize(length + 1);
+                entry.format_payload(m_scratch.data(), m_scratch.size(), entry.format, payload);
+            }
+            append_line(stamp(entry.time), { m_scratch.data(), static_cast<std::size_t>(length) });
+            m_text.push_back('\n');
+        }
+
+        void append_line(std::string_view prefix, std::string_view text) {
+            m_text.append(prefix).append(text);
+        }
+
+        // "[YYYY-MM-DD hh:mm:ss] " of `time`, formatted once per second
+        std::string_view stamp(std::int64_t time) {
+            const auto seconds = static_cast<std::time_t>(time / 1'000'000'000);
+            if(seconds != m_stampSecond || !m_stampLength) {
+                std::tm local {};
+                localtime_r(&seconds, &local);
+                m_stampLength = std::snprintf(m_stamp, sizeof(m_stamp), "[%d-%02d-%02d %02d:%02d:%02d] ",
+                                              local.tm_year + 1900, local.tm_mon + 1, local.tm_mday,
+                                              local.tm_hour, local.tm_min, local.tm_sec);
+                m_stampSecond = seconds;
+            }
+            return { m_stamp, static_cast<std::size_t>(m_stampLength) };
+        }
+
+        void write(std::FILE* output) {
+            if(m_text.empty())
+                return;
+            std::fwrite(m_text.data(), 1, m_text.size(), output);
+            std::fflush(output);
+            m_text.clear();
+        }
+
+        std::mutex m_lock;                  // guards the members up to m_thread
+        std::condition_variable m_wake;
+        std::condition_variable m_flushedWake;
+        std::vector<std::shared_ptr<thread_ring>> m_rings;
+        std::FILE* m_output = stderr;
+        std::uint64_t m_retiredDropped = 0;
+        std::uint64_t m_flushRequested = 0;
+        std::uint64_t m_flushed = 0;
+        bool m_stop = false;
+        bool m_stopped = false;
+        std::thread m_thread;
+
+        // logger thread only
+        std::vector<std::shared_ptr<thread_ring>> m_active;
+        std::string m_text;
+        std::string m_scratch = std::string(1024, '\0');   // one formatted record, grown to the longest
+        std::uint64_t m_reportedDropped = 0;
+        std::time_t m_stampSecond = 0;
+        int m_stampLength = 0;
+        char m_stamp[64] {};
+    };
+
+    // the ring of the calling thread, retired when the thread exits
+    struct ring_owner {
+        std::shared_ptr<thread_ring> ring;
+
+        ~ring_owner() {
+            if(ring)
+                ring->retire();
+        }
+    };
+
+    thread_local ring_owner t_owner;
+    thread_local thread_ring* t_ring = nullptr;
+
+    thread_ring& local_ring() {
+        if(!t_ring) [[unlikely]] {
+            t_owner.ring = backend::instance().attach();
+            t_ring = t_owner.ring.get();
+        }
+        return *t_ring;
+    }
+
+}
+
+namespace logging {
+
+    namespace detail {
+
+        std::byte* reserve(std::size_t size) {
+            return local_ring().reserve(size);
+        }
+
+        void commit() {
+            local_ring().commit();
+        }
+
+        std::int64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        void write_text(int priority, std::int64_t time, std::string_view text) {
+            const auto size = std::min(aligned(sizeof(record) + text.size() + 1), MaxRecord);
+            auto at = reserve(size);
+            if(!at)
+                return;
+            const auto length = std::min(text.size(), size - sizeof(record) - 1);
+            *reinterpret_cast<record*>(at) = { static_cast<std::uint32_t>(size), priority, time, nullptr, nullptr };
+            std::memcpy(at + sizeof(record), text.data(), length);
+            at[sizeof(record) + length] = std::byte { 0 };
+            commit();
+        }
+
+    }
+
+    void set_level(int priority) {
+        detail::threshold.store(priority, std::memory_order::relaxed);
+    }
+
+    void set_output(std::FILE* output) {
+        backend::instance().set_output(output);
+    }
+
+    void vwrite(int priority, const char* format, std::va_list args) {
+        if(!enabled(priority))
+            return;
+        const auto time = detail::now();
+        char text[512];
+        std::va_list copy;
+        va_copy(copy, args);
+        const int length = std::vsnprintf(text, sizeof(text), format, copy);
+        va_end(copy);
+        if(length < 0)
+            return;
+        if(static_cast<std::size_t>(length) < sizeof(text)) {
+            detail::write_text(priority, time, { text, static_cast<std::size_t>(length) });
+            return;
+        }
+        // too long for the stack buffer: formatted a second time, straight into the ring
+        const auto size = std::min(detail::aligned(sizeof(record) + length + 1), detail::MaxRecord);
+        auto at = detail::reserve(size);
+        if(!at)
+            return;
+        *reinterpret_cast<record*>(at) = { static_cast<std::uint32_t>(size), priority, time, nullptr, nullptr };
+        std::vsnprintf(reinterpret_cast<char*>(at + sizeof(record)), size - sizeof(record), format, args);
+        detail::commit();
+    }
+
+    void flush() {
+        backend::instance().flush();
+    }
+
+    std::uint64_t dropped() {
+        return backend::instance().dropped();
+    }
+
+}
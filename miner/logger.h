@@ -0,0 +1,201 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Asynchronous logger. A call copies its format pointer and arguments as one binary record
+ * into a lock-free ring owned by the calling thread and returns; a background thread merges
+ * the rings in time order, formats the records (printf syntax) and writes them out.
+ *
+ * Producers never lock, allocate or do I/O: when their ring is full the record is dropped and
+ * counted. Formats must outlive the process (string literals); string arguments are copied.
+ * The one exception is a record whose arguments take more than MaxRecord bytes (huge strings):
+ * it is formatted on the calling thread through temporary heap buffers and queued as text.
+ */
+namespace logging {
+
+    // syslog priority values, so LOG_ERR .. LOG_DEBUG can be passed as they are
+    enum priority : int {
+        error = 3,
+        warning = 4,
+        notice = 5,
+        info = 6,
+        debug = 7
+    };
+
+    namespace detail {
+
+        extern std::atomic<int> threshold;
+
+        constexpr std::size_t Align = 8;
+        // larger records are formatted on the calling thread and queued as truncated text
+        constexpr std::size_t MaxRecord = 16 * 1024;
+
+        constexpr std::size_t aligned(std::size_t size) {
+            return (size + Align - 1) & ~(Align - 1);
+        }
+
+        // formats the payload of a record as snprintf would, returns the full length
+        using formatter = int (*)(char* out, std::size_t size, const char* format, const std::byte* payload);
+
+        struct record {
+            std::uint32_t size;         // header and payload, a multiple of Align
+            std::int32_t priority;      // negative: padding up to the end of the ring
+            std::int64_t time;          // system_clock nanoseconds
+            const char* format;         // nullptr: the payload is preformatted text
+            formatter format_payload;
+        };
+
+        // arithmetic values and pointers are stored as they are
+        template<typename T>
+        struct codec {
+            static_assert(std::is_arithmetic_v<T> || std::is_pointer_v<T>, "unsupported log argument type");
+
+            static std::size_t size(T) {
+                return aligned(sizeof(T));
+            }
+
+            static void put(std::byte*& at, T value) {
+                std::memcpy(at, &value, sizeof(T));
+                at += aligned(sizeof(T));
+            }
+
+            static T get(const std::byte*& at) {
+                T value;
+                std::memcpy(&value, at, sizeof(T));
+                at += aligned(sizeof(T));
+                return value;
+            }
+        };
+
+        // strings are copied NUL-terminated behind their length and formatted as const char*
+        struct string_codec {
+            static std::size_t size(std::string_view text) {
+                return aligned(sizeof(std::uint32_t) + text.size() + 1);
+            }
+
+            static void put(std::byte*& at, std::string_view text) {
+                const auto length = static_cast<std::uint32_t>(text.size());
+                std::memcpy(at, &length, sizeof(length));
+                std::memcpy(at + sizeof(length), text.data(), text.size());
+                at[sizeof(length) + text.size()] = std::byte { 0 };
+                at += size(text);
+            }
+
+            static const char* get(const std::byte*& at) {
+                std::uint32_t length;
+                std::memcpy(&length, at, sizeof(length));
+                auto text = reinterpret_cast<const char*>(at + sizeof(length));
+                at += aligned(sizeof(length) + length + 1);
+                return text;
+            }
+        };
+
+        template<>
+        struct codec<const char*> {
+            static std::size_t size(const char* text) {
+                return string_codec::size(text ? text : "(null)");
+            }
+
+            static void put(std::byte*& at, const char* text) {
+                string_codec::put(at, text ? text : "(null)");
+            }
+
+            static const char* get(const std::byte*& at) {
+                return string_codec::get(at);
+            }
+        };
+
+        template<> struct codec<char*> : codec<const char*> {};
+        template<> struct codec<std::string> : string_codec {};
+        template<> struct codec<std::string_view> : string_codec {};
+
+        template<typename T>
+        using codec_of = codec<std::decay_t<T>>;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+        template<typename... Args>
+        int format(char* out, std::size_t size, const char* format, [[maybe_unused]] const std::byte* payload) {
+            // a braced list decodes the arguments left to right
+            return std::apply([&](auto... values) { return std::snprintf(out, size, format, values...); },
+                              std::tuple { codec_of<Args>::get(payload)... });
+        }
+#pragma GCC diagnostic pop
+
+        // room for `size` bytes in the calling thread's ring, nullptr (and counted) when full
+        std::byte* reserve(std::size_t size);
+
+        // publishes the record written to the last reserve()
+        void commit();
+
+        std::int64_t now();
+
+        // queues `text` as a preformatted record, truncated to MaxRecord
+        void write_text(int priority, std::int64_t time, std::string_view text);
+
+    }
+
+    // records above `priority` (less severe) are skipped at the call site, everything by default
+    void set_level(int priority);
+
+    inline bool enabled(int priority) {
+        return priority <= detail::threshold.load(std::memory_order::relaxed);
+    }
+
+    // where the background thread writes, stderr by default
+    void set_output(std::FILE* output);
+
+    template<typename... Args>
+    void write(int priority, const char* format, const Args&... args) {
+        if(!enabled(priority))
+            return;
+        const auto time = detail::now();
+        const auto size = sizeof(detail::record) + (std::size_t { 0 } + ... + detail::codec_of<Args>::size(args));
+        if(size > detail::MaxRecord) [[unlikely]] {
+            // the documented exception: allocates and formats here, see the top of this file
+            std::vector<std::byte> payload(size);
+            [[maybe_unused]] auto at = payload.data();
+            (detail::codec_of<Args>::put(at, args), ...);
+            std::string text(detail::MaxRecord, '\0');
+            const int length = detail::format<Args...>(text.data(), text.size(), format, payload.data());
+            text.resize(length < 0 ? 0 : std::min<std::size_t>(length, text.size() - 1));
+            detail::write_text(priority, time, text);
+            return;
+        }
+        auto at = detail::reserve(size);
+        if(!at)
+            return;
+        *reinterpret_cast<detail::record*>(at) = { static_cast<std::uint32_t>(detail::aligned(size)), priority, time, format,
+                                                   &detail::format<Args...> };
+        at += sizeof(detail::record);
+        (detail::codec_of<Args>::put(at, args), ...);
+        detail::commit();
+    }
+
+    // printf-style entry for va_list callers: formatted on the calling thread, written asynchronously
+    void vwrite(int priority, const char* format, std::va_list args);
+
+    // blocks until every record queued before the call has been written
+    void flush();
+
+    // records lost to full rings so far
+    std::uint64_t dropped();
+
+}
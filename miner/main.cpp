@@ -1,67 +1,414 @@
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <map>
+#include <mutex>
 #include <random>
 #include <cassert>
 #include <cstring>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
 
-#include "sha256_openssl.h"
+#include "sha256_lanes.h"
+#include "header_hasher.h"
+#include "mining_job.h"
+#include "stratum_client.h"
+#include "block_template.h"
+#include "rpc_transport.h"
+#include "hex.h"
 #include  "miner.h"
 
-using header_t = std::array<unsigned char, 80>;
+using header_t = crypto::sha256_lanes::header_t;
 
+template<typename Hasher>
 struct data  {
     header_t header;
+    Hasher hasher;
+    crypto::target256 target;
 };
 
-template<typename T, std::size_t Size>
-auto compute_hash(const std::array<T, Size>& to_compute) {
-    crypto::sha256_openssl context;
-    context.update((unsigned char*)to_compute.data(), 80);
-    return context.finalize();
-};
+// target of the hashes whose top `complexity` bytes, read as a little-endian number, are zero
+crypto::target256 complexity_target(int complexity) {
+    crypto::target256::hash_t bytes;
+    bytes.fill(0xff);
+    for(int i = 0; i < complexity && i < 32; ++i)
+        bytes[31 - i] = 0;
+    return crypto::target256::from_le(bytes);
+}
 
-void test_function1(int complexity) {
-    data data_obj;
+template<typename Hasher>
+data<Hasher> random_job(int complexity) {
+    header_t header = {0};
 
     std::random_device r;
     std::default_random_engine e1(r());
     std::uniform_int_distribution<int> uniform_dist(0, 256);
 
     for(unsigned i{0}; i < 75; ++i) {
-        data_obj.header[i] = uniform_dist(e1);
+        header[i] = uniform_dist(e1);
     }
+    return { header, Hasher(header), complexity_target(complexity) };
+}
 
-    miner miner_obj(
-            data_obj,
-            [&](const data& d, unsigned id){
-                header_t to_compute = d.header;
-                auto* header_ptr = (uint32_t*)to_compute.data();
-                header_ptr[19] = id;
+// nonce that passed the top-32-bit probe, with its full digest for the check stage
+struct candidate {
+    unsigned nonce;
+    crypto::sha256::hash_t hash;
+};
 
-                return compute_hash(compute_hash(to_compute));
-            },
-            [&] (const crypto::sha256::hash_t& hash ){
-                uint8_t* presult = (uint8_t * )hash.data();
-                for(unsigned i = 31; i >= 32 - complexity; --i){
-                    //printf("%02X ", presult[i]);
-                    if(presult[i] > 0) return false;
+/*
+ * Runs `jobs` random jobs of the given complexity on one miner (and one worker pool).
+ *
+ * @param Hasher header hashing policy, resolved at compile time:
+ *  crypto::sha256_lanes goes through the batch contract: a range is probed a SIMD batch at a time
+ *  in check-only mode and only the survivors are hashed in full and handed to the check;
+ *  crypto::header_hasher<Sha256> hashes one nonce per call through the per-nonce adapter.
+ */
+template<typename Hasher = crypto::sha256_lanes>
+void test_function1(int complexity, unsigned jobs) {
+    auto run = [=](auto& miner_obj, auto&& full_hash) {
+        for (unsigned _{0}; _ < jobs; ++_) {
+            auto job = random_job<Hasher>(complexity);
+            auto res = miner_obj.do_work(job);
+            if (!res) {
+                std::cout << "not found" << std::endl;
+                continue;
+            }
+            assert(job.target.met_by(full_hash(job, *res)));
+            std::cout << *res << std::endl;
+        }
+        std::cout << "hashrate: " << miner_obj.stats().hashrate / 1e6 << " MH/s" << std::endl;
+    };
+
+    if constexpr (std::is_same_v<Hasher, crypto::sha256_lanes>) {
+        miner miner_obj(
+                random_job<Hasher>(complexity),
+                [](data<Hasher>& d, nonce_range range, std::span<candidate> candidates){
+                    std::size_t count = 0;
+                    const auto top_limit = d.target.top32();
+                    crypto::sha256_lanes::top_batch_t tops;
+                    for(unsigned base = 0; base < range.count; base += tops.size()) {
+                        d.hasher.probe(range.first + base, tops);
+                        for(unsigned i = 0; i < tops.size(); ++i)
+                            if(tops[i] <= top_limit)
+                                candidates[count++] = { range.first + base + i, d.hasher.compute_one(range.first + base + i) };
+                    }
+                    return count;
+                },
+                [] (const data<Hasher>& d, std::span<const candidate> candidates) -> std::optional<std::size_t> {
+                    for(std::size_t i = 0; i < candidates.size(); ++i)
+                        if(d.target.met_by(candidates[i].hash))
+                            return i;
+                    return std::nullopt;
+                }
+        );
+        run(miner_obj, [](const data<Hasher>& d, unsigned nonce){ return d.hasher.compute_one(nonce); });
+    } else {
+        miner miner_obj(
+                random_job<Hasher>(complexity),
+                [](const data<Hasher>& d, unsigned first_id){
+                    auto hash = d.hasher.compute(first_id);
+                    return std::uint32_t(hash[28]) | (std::uint32_t(hash[29]) << 8)
+                         | (std::uint32_t(hash[30]) << 16) | (std::uint32_t(hash[31]) << 24);
+                },
+                [] (const data<Hasher>& d, std::uint32_t top){
+                    return top <= d.target.top32();
                 }
-                return true;
+        );
+        run(miner_obj, [](const data<Hasher>& d, unsigned nonce){ return d.hasher.compute(nonce); });
+    }
+}
+
+// stratum-style job: the miner rolls ntime and extranonce2 by itself once a header's nonces run out
+mining_job random_mining_job() {
+    std::random_device r;
+    std::default_random_engine e1(r());
+    std::uniform_int_distribution<int> uniform_dist(0, 255);
+
+    mining_job job;
+    job.version = 0x20000000;
+    for(auto&& byte : job.prev_hash)
+        byte = uniform_dist(e1);
+    job.coinbase1.resize(42);
+    job.coinbase2.resize(60);
+    for(auto&& byte : job.coinbase1)
+        byte = uniform_dist(e1);
+    for(auto&& byte : job.coinbase2)
+        byte = uniform_dist(e1);
+    job.extranonce1 = {0xde, 0xad, 0xbe, 0xef};
+    job.merkle_branch.resize(4);
+    for(auto&& hash : job.merkle_branch)
+        for(auto&& byte : hash)
+            byte = uniform_dist(e1);
+    job.ntime = 1650000000;
+    job.nbits = 0x1d00ffff;
+    job.ntime_roll = 60;
+    return job;
+}
+
+void test_function2(int complexity, unsigned jobs) {
+    using work_t = job_work<crypto::sha256_lanes>;
+    const std::uint32_t top_limit = complexity_target(complexity).top32();
+
+    miner miner_obj(
+            work_t(random_mining_job()),
+            [](const work_t& w, unsigned first_id){
+                return w.hasher().probe(first_id);
+            },
+            [=] (std::uint32_t top){
+                return top <= top_limit;
             }
     );
 
-    auto res = miner_obj.do_work();
-    std::cout << res << std::endl;
+    for (unsigned _{0}; _ < jobs; ++_) {
+        auto share = miner_obj.do_work(work_t(random_mining_job()));
+        if (share)
+            std::cout << share->extranonce2 << " " << share->ntime << " " << share->nonce << std::endl;
+        else
+            std::cout << "not found" << std::endl;
+    }
+}
+
+// nonce whose top 32 bits fit the share target, with its full digest
+struct share_candidate {
+    unsigned nonce;
+    crypto::sha256::hash_t hash;
+};
+
+using work_t = job_work<crypto::sha256_lanes>;
+
+// miner for upstream jobs: probes a range per call and checks survivors against the job's share target
+auto share_miner(const mining_job& job) {
+    return miner(
+            work_t(job),
+            [](work_t& w, nonce_range range, std::span<share_candidate> candidates) {
+                const auto top_limit = w.job().target.top32();
+                std::size_t count = 0;
+                crypto::sha256_lanes::top_batch_t tops;
+                for(unsigned base = 0; base < range.count; base += tops.size()) {
+                    w.hasher().probe(range.first + base, tops);
+                    for(unsigned i = 0; i < tops.size(); ++i)
+                        if(tops[i] <= top_limit)
+                            candidates[count++] = { range.first + base + i, w.hasher().compute_one(range.first + base + i) };
+                }
+                return count;
+            },
+            [](const work_t& w, std::span<const share_candidate> candidates) -> std::optional<std::size_t> {
+                for(std::size_t i = 0; i < candidates.size(); ++i)
+                    if(w.job().target.met_by(candidates[i].hash))
+                        return i;
+                return std::nullopt;
+            });
+}
+
+/*
+ * Pool mining over Stratum: every mining.notify preempts the running search, shares go out
+ * as soon as they are found and the search resumes right after them.
+ *
+ * @param url stratum+tcp://host:port
+ */
+int run_stratum(const std::string& url, const std::string& user, const std::string& password) {
+    auto scheme = url.find("://");
+    auto address = scheme == std::string::npos ? url : url.substr(scheme + 3);
+    auto colon = address.rfind(':');
+    if(colon == std::string::npos) {
+        std::cerr << "expected stratum+tcp://host:port" << std::endl;
+        return 1;
+    }
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::optional<mining_job> latest;
+    std::function<void(const mining_job&)> forward;   // to the miner once it runs
+
+    stratum_client client({ address.substr(0, colon), address.substr(colon + 1), user, password },
+                          [&](const mining_job& job, bool clean) {
+        std::cout << "job " << job.id << (clean ? " (new block)" : "") << std::endl;
+        std::lock_guard guard(lock);
+        latest = job;
+        if(forward)
+            forward(job);
+        changed.notify_all();
+    });
+
+    std::thread mining([&] {
+        std::unique_lock guard(lock);
+        changed.wait(guard, [&] { return latest.has_value(); });
+        auto job = *latest;
+        guard.unlock();
+
+        auto miner_obj = share_miner(job);
+
+        guard.lock();
+        forward = [&](const mining_job& next) { miner_obj.preempt(work_t(next)); };
+        if(latest->id != job.id)
+            miner_obj.preempt(work_t(*latest));
+        guard.unlock();
+
+        for(auto share = miner_obj.do_work();;) {
+            if(share) {
+                client.submit(*share, [share = *share](bool accepted, const std::string& error) {
+                    std::cout << "share " << share.job_id << " " << share.extranonce2 << " " << share.ntime << " " << share.nonce
+                              << (accepted ? " accepted" : " rejected: " + error) << std::endl;
+                });
+                share = miner_obj.resume();
+                continue;
+            }
+            // every roll of the job searched: wait for the next one
+            guard.lock();
+            auto searched = latest->id;
+            changed.wait(guard, [&] { return latest->id != searched; });
+            guard.unlock();
+            share = miner_obj.do_work();
+        }
+    });
+
+    for(;;) {
+        if(!client.connected()) {
+            std::cout << "connecting to " << address << std::endl;
+            if(!client.connect())
+                std::cerr << "connection failed" << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(5));
+    }
+}
+
+/*
+ * Solo mining on our own node: getblocktemplate work with a locally built coinbase paying
+ * `payout_script`, blocks go out through submitblock. A BIP 22 long poll stays open on the node
+ * and a new template preempts the running search as soon as it is answered (plain polling every
+ * few seconds when the node does not offer long polling). Polls and submissions share one
+ * transport and run concurrently, the miner never waits for a submission.
+ */
+int run_solo(const std::string& url, const std::string& userpass, const std::string& payout_script) {
+    block_template::options options;
+    options.payout_script.resize(payout_script.size() / 2);
+    if(!hex::decode(payout_script, options.payout_script.data(), options.payout_script.size())) {
+        std::cerr << "expected the payout scriptPubKey in hex" << std::endl;
+        return 1;
+    }
+
+    constexpr std::chrono::seconds PollInterval { 5 };
+    constexpr std::chrono::minutes LongPollTimeout { 10 };
+
+    rpc_transport rpc(url, userpass);
+    // with a longpoll id the node answers once its template differs from that one
+    auto fetch = [&](const std::string& longpoll_id = {}) -> std::optional<block_template> {
+        std::string request = "{\"rules\":[\"segwit\"]";
+        if(!longpoll_id.empty())
+            request += ",\"longpollid\":" + json::quote(longpoll_id);
+        auto reply = rpc.call("getblocktemplate", "[" + request + "}]", longpoll_id.empty() ? rpc_transport::DefaultTimeout : LongPollTimeout);
+        if(!reply.result) {
+            std::cerr << "getblocktemplate failed: " << reply.error << std::endl;
+            return std::nullopt;
+        }
+        auto tmpl = block_template::parse(*reply.result, options);
+        if(!tmpl)
+            std::cerr << "malformed block template" << std::endl;
+        return tmpl;
+    };
+
+    std::optional<block_template> first;
+    while(!(first = fetch()))
+        std::this_thread::sleep_for(PollInterval);
+
+    // templates by job id, a share is serialized against the one it was found on; the oldest
+    // are evicted first, so the current and the previous template (still searched) always stay
+    constexpr std::size_t MaxTemplates = 16;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::map<std::string, block_template> templates { { first->job.id, *first } };
+    std::deque<std::string> template_order { first->job.id };
+    std::string latest = first->job.id;
+    auto miner_obj = share_miner(first->job);
+
+    std::thread poller([&, longpoll_id = first->longpoll_id]() mutable {
+        for(;;) {
+            if(longpoll_id.empty())
+                std::this_thread::sleep_for(PollInterval);
+            const auto requested = std::chrono::steady_clock::now();
+            auto tmpl = fetch(longpoll_id);
+            const auto noticed = std::chrono::steady_clock::now();
+            if(!tmpl) {
+                // a long poll that merely timed out is reissued at once, a failing node is given time
+                if(longpoll_id.empty() || noticed - requested < LongPollTimeout)
+                    std::this_thread::sleep_for(PollInterval);
+                continue;
+            }
+            std::lock_guard guard(lock);
+            // a node answering the long poll with the same template is polled plainly for one round
+            longpoll_id = tmpl->job.id == latest ? std::string() : tmpl->longpoll_id;
+            if(tmpl->job.id == latest)
+                continue;
+            auto previous = miner_obj.preemption();
+            std::cout << "template " << tmpl->height << ", " << tmpl->transactions.size() << " transactions";
+            if(previous.count)
+                std::cout << " (last switch: first hash " << std::chrono::duration_cast<std::chrono::microseconds>(previous.last_first_hash).count()
+                          << " us after the notification)";
+            std::cout << std::endl;
+            latest = tmpl->job.id;
+            miner_obj.preempt(work_t(tmpl->job), noticed);
+            // an id seen before (the node went back to an older template) becomes the newest again
+            if(templates.erase(latest))
+                template_order.erase(std::find(template_order.begin(), template_order.end(), latest));
+            for(; templates.size() >= MaxTemplates; template_order.pop_front())
+                templates.erase(template_order.front());
+            templates.emplace(latest, std::move(*tmpl));
+            template_order.push_back(latest);
+            changed.notify_all();
+        }
+    });
+
+    for(auto solution = miner_obj.do_work();;) {
+        std::unique_lock guard(lock);
+        if(solution) {
+            auto tmpl = templates.find(solution->job_id);
+            if(tmpl == templates.end()) {
+                std::cerr << "block " << solution->job_id << " nonce " << solution->nonce
+                          << ": its template was evicted, the block cannot be rebuilt" << std::endl;
+            } else {
+                rpc.call("submitblock", "[\"" + tmpl->second.block(*solution) + "\"]",
+                         [share = *solution](rpc_transport::response&& reply) {
+                    // null when accepted, otherwise the rejection reason
+                    std::cout << "block " << share.job_id << " nonce " << share.nonce << ": "
+                              << (reply.result && reply.result->is_null() ? "accepted" : reply.result ? reply.result->as_string() : reply.error)
+                              << " (" << std::chrono::duration_cast<std::chrono::milliseconds>(reply.latency).count() << " ms)" << std::endl;
+                });
+            }
+        }
+        // the found block or the exhausted template is done with: wait for the next one
+        auto searched = solution ? solution->job_id : latest;
+        changed.wait(guard, [&] { return latest != searched; });
+        auto next = templates.at(latest).job;
+        guard.unlock();
+        // a template preempted after the wait is newer than `next` and searched instead
+        solution = miner_obj.do_work(work_t(next));
+    }
 }
 
-int main() {
-    for (unsigned _{0}; _ < 10; ++_)
-        test_function1(1);
+int main(int argc, char** argv) {
+    std::cout << "sha256 backend: " << crypto::sha256_lanes::backend() << std::endl;
 
-    for (unsigned _{0}; _ < 10; ++_)
-        test_function1(2);
+    // ezminer stratum+tcp://host:port user password
+    // ezminer http://host:port user:password payout_script_hex
+    if(argc >= 2 && std::string(argv[1]).rfind("stratum", 0) == 0)
+        return run_stratum(argv[1], argc >= 3 ? argv[2] : "", argc >= 4 ? argv[3] : "");
+    if(argc >= 4)
+        return run_solo(argv[1], argv[2], argv[3]);
 
-    for (unsigned _{0}; _ < 10; ++_)
-        test_function1(3);
+    test_function1(1, 10);
+    test_function1(2, 10);
+    test_function1(3, 10);
+    crypto::dispatch_transform([](auto kernel) {
+        test_function1<crypto::header_hasher<crypto::basic_sha256<typename decltype(kernel)::type>>>(2, 10);
+    });
+    test_function2(2, 10);
 }
@@ -1,30 +1,177 @@
-/* 
+/*
  *       Copyright (C) 2022 ElectronRock - All Rights Reserved
  */
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <thread>
 #include <vector>
 #include <atomic>
 #include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <memory>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "cpu_topology.h"
+
+// per-worker counters behind miner::stats(); build with MINER_TELEMETRY=0 to compile them out
+#ifndef MINER_TELEMETRY
+#define MINER_TELEMETRY 1
+#endif
+
+/*
+ * Job data that can extend the search beyond 2^32 nonces (see mining_job / job_work).
+ * Roll 0 is the data itself; rolled(r) is the data for the r-th header variant, and solution()
+ * turns (roll, nonce) into whatever identifies the share, e.g. (extranonce2, ntime, nonce).
+ */
+template<typename Data>
+concept rollable_data = requires(const Data& data, std::uint64_t roll, unsigned nonce) {
+    { data.roll_count() } -> std::convertible_to<std::uint64_t>;
+    { data.rolled(roll) } -> std::convertible_to<Data>;
+    data.solution(roll, nonce);
+};
+
+// how the worker pool is laid out over the machine
+struct miner_options {
+    unsigned threads = 0;   // worker count, 0 for one per CPU the process may run on
+    bool pin = false;       // bind each worker to its CPU
+    bool numa = true;       // group workers by NUMA node, keep them on their node's CPUs and give every node its own copy of the job
+};
+
+// how long switching a running search to a preempting job took, see miner::preempt
+struct miner_preemption {
+    std::uint64_t count = 0;
+    std::chrono::nanoseconds last { 0 };    // preempt() until the new job was handed to the workers
+    std::chrono::nanoseconds max { 0 };
+    std::chrono::nanoseconds last_first_hash { 0 }; // the notification until a batch of the new job was hashed
+    std::chrono::nanoseconds max_first_hash { 0 };
+};
+
+// miner::stats() snapshot, all counters cumulative since the miner was built
+struct miner_stats {
+    struct thread {
+        std::uint64_t nonces = 0;           // nonces hashed
+        std::uint64_t candidates = 0;       // nonces handed to the check
+        std::chrono::nanoseconds busy { 0 };
+        double hashrate = 0;                // nonces / busy, in H/s
+    };
+
+    std::vector<thread> threads;
+    std::uint64_t nonces = 0;
+    std::uint64_t candidates = 0;
+    std::uint64_t jobs = 0;                 // finished do_work calls
+    std::chrono::nanoseconds last_job { 0 };  // wall time of the last do_work
+    std::chrono::nanoseconds job_time { 0 };  // wall time of all of them
+    double hashrate = 0;                    // nonces / job_time, in H/s
+};
+
+// nonces first .. first + count - 1 of one header, the unit of work of the batch contract
+struct nonce_range {
+    unsigned first;
+    unsigned count;
+};
+
+namespace miner_detail {
+
+    // parameter types of a non-generic callable
+    template<typename F>
+    struct arguments : arguments<decltype(&F::operator())> {};
+
+    template<typename R, typename... A>
+    struct arguments<R (*)(A...)> {
+        using type = std::tuple<A...>;
+    };
+
+    template<typename R, typename C, typename... A>
+    struct arguments<R (C::*)(A...)> : arguments<R (*)(A...)> {};
+
+    template<typename R, typename C, typename... A>
+    struct arguments<R (C::*)(A...) const> : arguments<R (*)(A...)> {};
+
+    template<typename F>
+    concept non_generic = std::is_pointer_v<F> || requires { &F::operator(); };
+
+    template<typename F, typename Data, bool = non_generic<F>>
+    struct batch_work : std::false_type {};
+
+    template<typename F, typename Data>
+    struct batch_work<F, Data, true> {
+        using args = typename arguments<F>::type;
+        constexpr static bool value = std::tuple_size_v<args> == 3
+                && std::is_same_v<std::decay_t<std::tuple_element_t<1, args>>, nonce_range>;
+    };
+
+    template<typename F, typename Data>
+    struct batch_work_candidate {
+        using type = typename std::decay_t<std::tuple_element_t<2, typename arguments<F>::type>>::element_type;
+    };
+
+    // candidate produced by the per-nonce adapters: the check already passed
+    struct nonce_candidate {
+        unsigned nonce;
+    };
+
+}
+
+// what do_work reports: the nonce, or Data::solution(roll, nonce) for rollable job data
+template<typename Data>
+struct miner_solution {
+    using type = unsigned;
+};
+
+template<rollable_data Data>
+struct miner_solution<Data> {
+    using type = std::decay_t<decltype(std::declval<const Data&>().solution(std::uint64_t {}, 0u))>;
+};
 
 template<typename Data, typename WorkFunction, typename CheckFunction>
 class miner final {
+    using solution_t = typename miner_solution<Data>::type;
+
 public:
 
     /*
     * <Constructor>
     *
+    * Starts the worker pool. Workers live as long as the miner and sleep between jobs,
+    * so one miner is meant to serve the whole stream of jobs (see do_work(const Data&)).
+    *
     * @param data DTO object, contains previous block-chain header or what ever else;
     *
-    * @param workFunction the function to be used to compute hash, signature:
+    * @param workFunction the function to be used to compute hashes. Batch contract:
+    *    std::size_t WorkFunction(Data& scratch, nonce_range range, std::span<Candidate> candidates);
+    * hashes every nonce of the range (256 consecutive nonces starting at a multiple of 256), writes the ones worth a full check into `candidates`
+    * (Candidate is any type with an `unsigned nonce` member) and returns how many it wrote.
+    * `scratch` is the worker's private copy of the job, free to be patched (e.g. the nonce field).
+    * Per-nonce signatures are still accepted and adapted:
     *    hash_t WorkFunction(const Data& data, unsigned task_number);
+    * or, to hash a whole batch of consecutive nonces per call (e.g. one per SIMD lane):
+    *    std::array<hash_t, N> WorkFunction(const Data& data, unsigned first_task_number);
     *
     * @param checkFunction the function to be used to check weather computed hash suitable to the specified conditions
-    * or not (mean hash complexity), signature:
+    * or not (mean hash complexity). With the batch contract it sees all candidates of a range at once:
+    * std::optional<std::size_t> CheckFunction(const Data& data, std::span<const Candidate> candidates);
+    * returning the index of a candidate that meets the conditions. With per-nonce work functions:
     * bool CheckFunction(const hash_t& hash);
+    * or, when the condition is part of the job:
+    * bool CheckFunction(const Data& data, const hash_t& hash);
+    *
+    * When Data satisfies rollable_data the workers roll it once the 2^32 nonces of a header are exhausted,
+    * and do_work reports Data::solution(roll, nonce) instead of the bare nonce.
+    *
+    * @param options worker count and placement, see miner_options. Workers are laid out node by node
+    * over cpu_topology, so consecutive ids share a node (and, pinned, a CPU each); the job is
+    * replicated per node, first touched by a worker of that node. With numa and more than one node
+    * in use, unpinned workers are still bound to their node's CPUs so the replica stays local.
     *
     *  @usage
     * miner miner_obj(data,
@@ -32,64 +179,494 @@ public:
     *   [](const hash_t){ return true; }
     * );
     */
-    miner(const Data& data, WorkFunction&& workFunction, CheckFunction&& checkFunction)
+    miner(const Data& data, WorkFunction&& workFunction, CheckFunction&& checkFunction, miner_options options = {})
             : m_data(data)
               , m_workFunction(std::move(workFunction))
               , m_checkFunction(std::move(checkFunction)) {
+        place(options);
+        auto thread_count = static_cast<unsigned>(m_placement.size());
+        m_nodes.resize(m_nodeCount);
+        if constexpr (telemetry)
+            m_counters = std::make_unique<worker_counters[]>(thread_count);
+        m_pool.reserve(thread_count);
+        for (unsigned thread_id = 0; thread_id < thread_count; ++thread_id)
+            m_pool.emplace_back([=, this]{ worker(thread_id); });
+
+        // every node's first worker allocates that node's copy of the job
+        for(auto ready = m_ready.load(std::memory_order::acquire); ready != m_nodeCount; ready = m_ready.load(std::memory_order::acquire))
+            m_ready.wait(ready);
     };
 
     ~miner() {
+        m_stop.store(true);
+        m_job.fetch_add(1, std::memory_order::release);
+        m_job.notify_all();
         for(auto&& thread : m_pool)
             if(thread.joinable())
                 thread.join();
     }
 
-    auto do_work() {
-        auto thread_count = std::thread::hardware_concurrency();
-        m_pool.reserve(thread_count);
-        for(auto&& active : m_active)
-            active.store(true);
-        auto step = std::numeric_limits<unsigned>::max() / thread_count;
-        m_found = false;
-        for (unsigned thread_id = 0; thread_id < thread_count; ++thread_id) {
-            m_pool.emplace_back([=, this]{ 
-                auto first_nonce = thread_id * step;
-                find(thread_id, first_nonce, first_nonce + step);
-            });
+    /*
+    * Publishes a new job to the parked workers and blocks until one of them finds a suitable nonce.
+    *
+    * A job queued by preempt() since the last search is newer than `data` and is searched instead,
+    * so a preemption landing just before the call is never lost.
+    *
+    * @return the nonce (or the solution of a rollable Data), std::nullopt when the whole space was searched
+    */
+    auto do_work(const Data& data) {
+        {
+            std::lock_guard lock(m_pendingLock);
+            set_data(data);
         }
+        return do_work();
+    }
+
+    /*
+    * Searches the current job again, or the job queued by preempt() while idle.
+    *
+    * A preempt() during the search restarts it on the new job without returning,
+    * so the solution then belongs to the preempting job.
+    */
+    std::optional<solution_t> do_work() {
+        return run(true);
+    }
+
+    /*
+    * Continues the current job after a solution from the first position no worker has been handed yet.
+    *
+    * The unsearched rest of the other workers' blocks is skipped, so solutions never repeat:
+    * meant for pool mining, where every share must be distinct but no search has to be exhaustive.
+    * A job queued by preempt() starts from the beginning instead.
+    */
+    std::optional<solution_t> resume() {
+        return run(false);
+    }
 
-        m_found.wait(false);
+    /*
+    * Replaces the job of a running do_work or resume, callable from any thread (e.g. on a new block).
+    *
+    * Bumps the job epoch: every worker drops the stale job at its next batch boundary
+    * (at most ChunkAlign nonces later), then the search restarts on `data`. While idle the
+    * job is queued and taken by the next do_work(), resume() or do_work(data). preemption() reports
+    * how long the switch took, and how long after `noticed` (when the caller learned of the new job)
+    * its first batch was hashed.
+    *
+    * @return whether a search was running, false when the job was queued for the next one
+    */
+    bool preempt(const Data& data, std::chrono::steady_clock::time_point noticed = std::chrono::steady_clock::now()) {
+        std::lock_guard lock(m_pendingLock);
+        m_pending.emplace(data);
+        m_noticedAt = noticed;
+        if(m_searching)
+            m_preemptedAt = clock::now();
+        m_epoch.fetch_add(1, std::memory_order::relaxed);
+        return m_searching;
+    }
 
-        for(auto&& active : m_active)
-            active.store(false, std::memory_order::release);
-        
-        return m_result.load(std::memory_order::acquire);
+    miner_preemption preemption() const {
+        std::lock_guard lock(m_pendingLock);
+        return m_preemption;
+    }
+
+    // aggregated worker counters, empty when built with MINER_TELEMETRY=0
+    miner_stats stats() const {
+        miner_stats result;
+        if constexpr (telemetry) {
+            const auto rate = [](std::uint64_t nonces, std::chrono::nanoseconds time) {
+                return time.count() > 0 ? nonces * 1e9 / time.count() : 0.0;
+            };
+            result.threads.resize(m_pool.size());
+            for(std::size_t thread = 0; thread < m_pool.size(); ++thread) {
+                auto& stats = result.threads[thread];
+                const auto& counters = m_counters[thread];
+                stats.nonces = counters.nonces.load(std::memory_order::relaxed);
+                stats.candidates = counters.candidates.load(std::memory_order::relaxed);
+                stats.busy = std::chrono::nanoseconds(counters.busy.load(std::memory_order::relaxed));
+                stats.hashrate = rate(stats.nonces, stats.busy);
+                result.nonces += stats.nonces;
+                result.candidates += stats.candidates;
+            }
+            result.jobs = m_jobs.load(std::memory_order::relaxed);
+            result.last_job = std::chrono::nanoseconds(m_lastJob.load(std::memory_order::relaxed));
+            result.job_time = std::chrono::nanoseconds(m_jobTime.load(std::memory_order::relaxed));
+            result.hashrate = rate(result.nonces, result.job_time);
+        }
+        return result;
     }
 
 private:
+    constexpr static std::uint64_t no_result = std::numeric_limits<std::uint64_t>::max();
+    constexpr static std::uint64_t NonceSpace = std::uint64_t { std::numeric_limits<unsigned>::max() } + 1;
+    constexpr static std::uint64_t ChunkAlign = 256;
+    constexpr static std::uint64_t MinChunk = 4096;
+    constexpr static std::uint64_t MaxChunk = 1 << 22;
+    constexpr static std::uint64_t ChunksPerThread = 4;
 
-    void find(unsigned thread, unsigned first_nonce, unsigned last_nonce){
-        for(unsigned nonce { first_nonce }; nonce < last_nonce && m_active[thread].load(); ++nonce) {
-            auto result = m_workFunction(m_data, nonce);
-            bool is_correct = m_checkFunction(result);
-            if (is_correct) {
-                m_result.store(nonce);
-                m_found = true;
-                m_found.notify_one();
-                break;
+    using clock = std::chrono::steady_clock;
+
+    constexpr static bool telemetry = MINER_TELEMETRY;
+
+    // each worker owns one line and is its only writer, so updates are plain relaxed load + store
+    struct alignas(64) worker_counters {
+        std::atomic<std::uint64_t> nonces { 0 };
+        std::atomic<std::uint64_t> candidates { 0 };
+        std::atomic<std::uint64_t> busy { 0 };      // ns
+
+        static void add(std::atomic<std::uint64_t>& counter, std::uint64_t value) {
+            counter.store(counter.load(std::memory_order::relaxed) + value, std::memory_order::relaxed);
+        }
+    };
+
+    // times one do_work call into the job counters
+    struct job_timer {
+        explicit job_timer(miner& owner) : owner(owner) {
+            if constexpr (telemetry)
+                start = clock::now();
+        }
+
+        ~job_timer() {
+            if constexpr (telemetry) {
+                auto elapsed = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+                owner.m_lastJob.store(elapsed, std::memory_order::relaxed);
+                owner.m_jobTime.store(owner.m_jobTime.load(std::memory_order::relaxed) + elapsed, std::memory_order::relaxed);
+                owner.m_jobs.store(owner.m_jobs.load(std::memory_order::relaxed) + 1, std::memory_order::relaxed);
+            }
+        }
+
+        miner& owner;
+        clock::time_point start;
+    };
+
+    constexpr static bool batch_contract = miner_detail::batch_work<WorkFunction, Data>::value;
+
+    // result of a per-nonce work function, only instantiated for the adapted signatures
+    template<typename W = WorkFunction>
+    using result_t = std::invoke_result_t<W&, const Data&, unsigned>;
+
+    template<bool Batch = batch_contract>
+    static auto candidate_type() {
+        if constexpr (Batch)
+            return typename miner_detail::batch_work_candidate<WorkFunction, Data>::type {};
+        else
+            return miner_detail::nonce_candidate {};
+    }
+    using candidate_t = decltype(candidate_type());
+
+    // node-local copy of the job, aligned so neighbouring replicas never share a line
+    struct alignas(64) node_data {
+        Data data;
+    };
+
+    struct worker_placement {
+        unsigned cpu;
+        unsigned node;          // replica index
+        unsigned cpu_node;      // cpu_topology node of cpu
+        bool leader;            // first worker of its node
+    };
+
+    // assigns workers to CPUs node by node, wrapping around when there are more workers than CPUs
+    void place(const miner_options& options) {
+        const auto& topology = cpu_topology::get();
+        auto thread_count = options.threads ? options.threads : topology.cpu_count();
+        m_pin = options.pin;
+        m_nodeCount = options.numa ? static_cast<unsigned>(topology.nodes.size()) : 1;
+
+        std::vector<worker_placement> cpus;
+        for(unsigned node = 0; node < topology.nodes.size(); ++node)
+            for(auto cpu : topology.nodes[node])
+                cpus.push_back({ cpu, options.numa ? node : 0, node, false });
+
+        m_placement.resize(thread_count);
+        std::vector<bool> led(m_nodeCount);
+        for(unsigned thread = 0; thread < thread_count; ++thread) {
+            m_placement[thread] = cpus[thread % cpus.size()];
+            m_placement[thread].leader = !led[m_placement[thread].node];
+            led[m_placement[thread].node] = true;
+        }
+        // with fewer workers than CPUs some nodes stay empty: only nodes with workers get a copy
+        std::vector<unsigned> index(m_nodeCount);
+        unsigned used = 0;
+        for(unsigned node = 0; node < m_nodeCount; ++node)
+            index[node] = led[node] ? used++ : 0;
+        for(auto&& placement : m_placement)
+            placement.node = index[placement.node];
+        m_nodeCount = used;
+        // first touch only places a replica on the node its leader happens to run on
+        m_bindNodes = !m_pin && m_nodeCount > 1;
+    }
+
+    // searches until a solution or the end of the space, following preempt()ed jobs
+    std::optional<solution_t> run(bool restart) {
+        const job_timer timer(*this);
+        for(;;) {
+            search(restart);
+            auto result = m_result.load(std::memory_order::acquire);
+            {
+                std::lock_guard lock(m_pendingLock);
+                if(result == no_result && m_pending)
+                    continue;
+                // a job preempting from here on is queued for the next search, only its first hash is timed
+                m_searching = false;
+                m_preemptedAt.reset();
+                m_awaitingHash.store(false, std::memory_order::relaxed);
+            }
+            if(result == no_result)
+                return std::nullopt;
+            if constexpr (rollable_data<Data>)
+                return m_data.solution(result >> 32, static_cast<unsigned>(result));
+            else
+                return static_cast<unsigned>(result);
+        }
+    }
+
+    // under m_pendingLock
+    void set_data(const Data& data) {
+        m_data = data;
+        for(auto&& node : m_nodes)
+            node->data = data;
+    }
+
+    // one search of the current (or pending) job, returns once every worker is parked again
+    void search(bool restart) {
+        auto thread_count = static_cast<unsigned>(m_pool.size());
+        std::optional<clock::time_point> preempted_at;
+        {
+            // taking the pending job and fixing the epoch together: a later preempt() always invalidates this search
+            std::lock_guard lock(m_pendingLock);
+            const bool preempting = m_pending.has_value();
+            if(preempting) {
+                set_data(*m_pending);
+                m_pending.reset();
+                preempted_at = std::exchange(m_preemptedAt, std::nullopt);
+                restart = true;
+            }
+            m_searchEpoch = m_epoch.load(std::memory_order::relaxed);
+            m_searching = true;
+            // published to the workers with the job below; a job queued while idle is timed from its notice too
+            m_awaitingHash.store(preempting, std::memory_order::relaxed);
+        }
+        m_result.store(no_result, std::memory_order::relaxed);
+        if(restart) {
+            m_cursor.store(0, std::memory_order::relaxed);
+            if constexpr (rollable_data<Data>)
+                m_space = std::max<std::uint64_t>(m_data.roll_count(), 1) * NonceSpace;
+        }
+        m_busy.store(thread_count, std::memory_order::relaxed);
+
+        m_job.fetch_add(1, std::memory_order::release);
+        m_job.notify_all();
+
+        if(preempted_at) {
+            std::lock_guard lock(m_pendingLock);
+            auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - *preempted_at);
+            ++m_preemption.count;
+            m_preemption.last = latency;
+            m_preemption.max = std::max(m_preemption.max, latency);
+        }
+
+        // every worker leaving its slice wakes us up; the finder ends the epoch when reporting.
+        // Returning only once all of them are parked again keeps m_data safe to replace.
+        for(auto busy = m_busy.load(std::memory_order::acquire); busy != 0; busy = m_busy.load(std::memory_order::acquire))
+            m_busy.wait(busy);
+    }
+
+    void worker(unsigned thread) {
+        const auto placement = m_placement[thread];
+        if(m_pin)
+            cpu_topology::pin_current_thread(placement.cpu);
+        else if(m_bindNodes)
+            cpu_topology::pin_current_thread(cpu_topology::get().nodes[placement.cpu_node]);
+        if(placement.leader) {
+            m_nodes[placement.node] = std::make_unique<node_data>(node_data { m_data });
+            m_ready.fetch_add(1, std::memory_order::release);
+            m_ready.notify_one();
+        }
+        const node_data* local = nullptr;
+
+        unsigned seen = 0; // m_job before the first publication, workers may start after it
+        std::array<candidate_t, ChunkAlign> candidates;
+        for(;;) {
+            m_job.wait(seen, std::memory_order::acquire);
+            seen = m_job.load(std::memory_order::acquire);
+            if(m_stop.load())
+                return;
+            const auto epoch = m_searchEpoch;
+
+            // this worker's scratch copy of the job, rolled from its previous roll when needed
+            std::optional<Data> scratch;
+            std::uint64_t scratch_roll = 0;
+            bool first_batch = true;
+
+            if(!local)
+                local = m_nodes[placement.node].get();
+            clock::time_point started;
+            if constexpr (telemetry)
+                started = clock::now();
+
+            while(auto range = next_range()) {
+                const std::uint64_t roll = range->first / NonceSpace;
+                if(!scratch)
+                    scratch.emplace(local->data);
+                if constexpr (rollable_data<Data>) {
+                    if(scratch_roll != roll) {
+                        scratch.emplace(scratch->rolled(roll));
+                        scratch_roll = roll;
+                    }
+                }
+                if(!find(thread, epoch, *scratch, range->first, range->second, candidates, first_batch))
+                    break;
+            }
+            if constexpr (telemetry)
+                worker_counters::add(m_counters[thread].busy, static_cast<std::uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count()));
+
+            m_busy.fetch_sub(1, std::memory_order::release);
+            m_busy.notify_one();
+        }
+    }
+
+    /*
+    * Hands out the next block of the search space from the shared cursor.
+    *
+    * Positions are roll * 2^32 + nonce; without rolling the space is the 32-bit nonce range.
+    * Guided scheduling: a block is a fixed share of what is left, so blocks start large and
+    * shrink towards the end of the space; whichever core is free takes the next one and
+    * fast cores never idle while slow ones still hold a long slice. Block sizes are
+    * multiples of ChunkAlign and never cross a roll, so batches never straddle two blocks
+    * and every position is covered exactly once.
+    */
+    std::optional<std::pair<std::uint64_t, std::uint64_t>> next_range() {
+        auto first = m_cursor.load(std::memory_order::relaxed);
+        std::uint64_t chunk;
+        do {
+            if(first >= m_space)
+                return std::nullopt;
+            auto share = (m_space - first) / (m_pool.size() * ChunksPerThread) / ChunkAlign * ChunkAlign;
+            auto roll_end = (first / NonceSpace + 1) * NonceSpace;
+            chunk = std::min(std::clamp(share, MinChunk, MaxChunk), roll_end - first);
+        } while(!m_cursor.compare_exchange_weak(first, first + chunk, std::memory_order::relaxed));
+        return std::pair { first, first + chunk };
+    }
+
+    template<typename Result>
+    bool check(const Data& data, const Result& result) {
+        if constexpr (std::is_invocable_r_v<bool, CheckFunction&, const Data&, const Result&>)
+            return m_checkFunction(data, result);
+        else
+            return m_checkFunction(result);
+    }
+
+    // runs the work function over one range, adapting the per-nonce signatures to the batch contract
+    std::size_t work(Data& scratch, nonce_range range, std::span<candidate_t> candidates) {
+        if constexpr (batch_contract) {
+            return m_workFunction(scratch, range, candidates);
+        } else if constexpr (std::is_invocable_r_v<bool, CheckFunction&, const result_t<>&>
+                             || std::is_invocable_r_v<bool, CheckFunction&, const Data&, const result_t<>&>) {
+            std::size_t count = 0;
+            for(unsigned i = 0; i < range.count; ++i)
+                if(check(scratch, m_workFunction(std::as_const(scratch), range.first + i)))
+                    candidates[count++] = { range.first + i };
+            return count;
+        } else {
+            constexpr unsigned batch_size = std::tuple_size_v<result_t<>>;
+            static_assert(ChunkAlign % batch_size == 0, "nonce blocks must hold whole batches");
+            std::size_t count = 0;
+            for(unsigned base = 0; base < range.count; base += batch_size) {
+                auto results = m_workFunction(std::as_const(scratch), range.first + base);
+                for(unsigned i = 0; i < batch_size; ++i)
+                    if(check(scratch, results[i]))
+                        candidates[count++] = { range.first + base + i };
             }
+            return count;
         }
     }
 
+    std::optional<std::size_t> check_candidates(const Data& data, std::span<const candidate_t> candidates) {
+        if constexpr (batch_contract)
+            return m_checkFunction(data, candidates);
+        else
+            return std::size_t { 0 };
+    }
+
+    // @return false when the search is over for this worker (found, or the epoch moved on)
+    bool find(unsigned thread, std::uint64_t epoch, Data& scratch, std::uint64_t first, std::uint64_t last,
+              std::array<candidate_t, ChunkAlign>& candidates, bool& first_batch){
+        for(std::uint64_t position { first }; position < last; position += ChunkAlign) {
+            if (m_epoch.load(std::memory_order::relaxed) != epoch)
+                return false;
+            nonce_range range { static_cast<unsigned>(position), static_cast<unsigned>(std::min(last - position, ChunkAlign)) };
+            auto count = work(scratch, range, candidates);
+            if(first_batch) {
+                first_batch = false;
+                hashed();
+            }
+            if constexpr (telemetry) {
+                worker_counters::add(m_counters[thread].nonces, range.count);
+                worker_counters::add(m_counters[thread].candidates, count);
+            }
+            if (count == 0)
+                continue;
+            auto index = check_candidates(scratch, std::span<const candidate_t>(candidates.data(), count));
+            if (index) {
+                report(position / NonceSpace * NonceSpace + candidates[*index].nonce);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // once per worker and search: the first one after a preempt() times the switch up to it
+    void hashed() {
+        if(!m_awaitingHash.load(std::memory_order::relaxed) || !m_awaitingHash.exchange(false, std::memory_order::relaxed))
+            return;
+        std::lock_guard lock(m_pendingLock);
+        auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_noticedAt);
+        m_preemption.last_first_hash = latency;
+        m_preemption.max_first_hash = std::max(m_preemption.max_first_hash, latency);
+    }
+
+    // the first report wins and ends the epoch, so the other workers stop at their next batch
+    void report(std::uint64_t position) {
+        std::uint64_t expected = no_result;
+        if(m_result.compare_exchange_strong(expected, position, std::memory_order::release))
+            m_epoch.fetch_add(1, std::memory_order::relaxed);
+    }
+
     Data m_data;
     WorkFunction m_workFunction;
     CheckFunction m_checkFunction;
-    constexpr static unsigned MaxThreadCount = 64;
-    std::atomic<unsigned> m_result;
-    std::array<std::atomic_bool, MaxThreadCount> m_active;
-    std::atomic_bool m_found;
+    std::vector<worker_placement> m_placement;
+    std::vector<std::unique_ptr<node_data>> m_nodes;
+    unsigned m_nodeCount { 1 };
+    bool m_pin { false };
+    bool m_bindNodes { false };     // unpinned workers are kept on their node's CPUs
+    std::atomic<unsigned> m_ready { 0 };
+    std::atomic<std::uint64_t> m_result { no_result };
+    // read by every worker once per batch, kept off the lines the cursor and counters bounce
+    alignas(64) std::atomic<std::uint64_t> m_epoch { 0 };
+    std::uint64_t m_searchEpoch { 0 };
+    alignas(64) std::atomic<std::uint64_t> m_cursor { 0 };
+    std::uint64_t m_space { NonceSpace };
+    std::atomic<unsigned> m_job { 0 };
+    std::atomic<unsigned> m_busy { 0 };
+    std::atomic_bool m_stop { false };
+    mutable std::mutex m_pendingLock;
+    std::optional<Data> m_pending;
+    std::optional<clock::time_point> m_preemptedAt;
+    clock::time_point m_noticedAt;
+    bool m_searching { false };
+    std::atomic_bool m_awaitingHash { false };     // no batch of the preempting job hashed yet
+    miner_preemption m_preemption;
+    std::unique_ptr<worker_counters[]> m_counters;
+    std::atomic<std::uint64_t> m_jobs { 0 };
+    std::atomic<std::uint64_t> m_lastJob { 0 };     // ns
+    std::atomic<std::uint64_t> m_jobTime { 0 };     // ns
     std::vector<std::thread> m_pool;
 };
 
 template<typename Data, typename WorkFunction, typename CheckFunction>
-miner(Data, WorkFunction, CheckFunction)->miner<Data, WorkFunction, CheckFunction>;
\ No newline at end of file
+miner(Data, WorkFunction, CheckFunction)->miner<Data, WorkFunction, CheckFunction>;
+
+template<typename Data, typename WorkFunction, typename CheckFunction>
+miner(Data, WorkFunction, CheckFunction, miner_options)->miner<Data, WorkFunction, CheckFunction>;
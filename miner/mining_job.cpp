@@ -0,0 +1,97 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "mining_job.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    constexpr std::uint64_t MaxRolls = std::uint64_t { 1 } << 31;
+
+    void store_le32(unsigned char* p, std::uint32_t value) {
+        for(unsigned i = 0; i < 4; ++i)
+            p[i] = static_cast<unsigned char>(value >> (i * 8));
+    }
+
+    mining_job::hash_t sha256(const unsigned char* data, std::size_t length) {
+        crypto::sha256_inline context;
+        context.update(data, length);
+        return context.finalize();
+    }
+
+}
+
+std::uint64_t mining_job::roll_count() const {
+    const std::uint64_t ntimes = std::uint64_t { ntime_roll } + 1;
+    const unsigned bits = std::min(extranonce2_size, 8u) * 8;
+    const std::uint64_t extranonces = bits >= 64 ? MaxRolls : std::uint64_t { 1 } << std::min(bits, 32u);
+    return std::min(ntimes * std::min(extranonces, MaxRolls), MaxRolls);
+}
+
+std::uint64_t mining_job::extranonce2_of(std::uint64_t roll) const {
+    return roll / (std::uint64_t { ntime_roll } + 1);
+}
+
+std::uint32_t mining_job::ntime_of(std::uint64_t roll) const {
+    return ntime + static_cast<std::uint32_t>(roll % (std::uint64_t { ntime_roll } + 1));
+}
+
+std::vector<unsigned char> mining_job::coinbase(std::uint64_t extranonce2) const {
+    std::vector<unsigned char> result;
+    result.reserve(coinbase1.size() + extranonce1.size() + extranonce2_size + coinbase2.size());
+    result.insert(result.end(), coinbase1.begin(), coinbase1.end());
+    result.insert(result.end(), extranonce1.begin(), extranonce1.end());
+    for(unsigned i = 0; i < extranonce2_size; ++i)
+        result.push_back(i < 8 ? static_cast<unsigned char>(extranonce2 >> (i * 8)) : 0);
+    result.insert(result.end(), coinbase2.begin(), coinbase2.end());
+    return result;
+}
+
+crypto::sha256_inline mining_job::coinbase_prefix() const {
+    crypto::sha256_inline context;
+    context.update(coinbase1.data(), coinbase1.size());
+    context.update(extranonce1.data(), extranonce1.size());
+    return context;
+}
+
+mining_job::hash_t mining_job::merkle_root(const crypto::sha256_inline& prefix, std::uint64_t extranonce2) const {
+    unsigned char extranonce[8] = {0};
+    for(unsigned i = 0; i < 8; ++i)
+        extranonce[i] = static_cast<unsigned char>(extranonce2 >> (i * 8));
+
+    auto context = prefix;
+    for(unsigned i = 0; i < extranonce2_size; i += 8) {
+        auto chunk = std::min(extranonce2_size - i, 8u);
+        if(i == 0) {
+            context.update(extranonce, chunk);
+        } else {
+            const unsigned char zero[8] = {0};
+            context.update(zero, chunk);
+        }
+    }
+    context.update(coinbase2.data(), coinbase2.size());
+    auto first = context.finalize();
+    auto root = sha256(first.data(), first.size());
+
+    unsigned char pair[64];
+    for(const auto& sibling : merkle_branch) {
+        std::memcpy(pair, root.data(), 32);
+        std::memcpy(pair + 32, sibling.data(), 32);
+        first = sha256(pair, sizeof(pair));
+        root = sha256(first.data(), first.size());
+    }
+    return root;
+}
+
+mining_job::header_t mining_job::header(const hash_t& merkle_root, std::uint32_t time) const {
+    header_t result = {0};
+    store_le32(result.data(), version);
+    std::memcpy(result.data() + 4, prev_hash.data(), 32);
+    std::memcpy(result.data() + 36, merkle_root.data(), 32);
+    store_le32(result.data() + 68, time);
+    store_le32(result.data() + 72, nbits);
+    return result;
+}
@@ -0,0 +1,155 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sha256_inline.h"
+#include "target.h"
+
+/*
+ * Everything needed to build block headers for one upstream job without asking the server again:
+ * the coinbase split around the extranonces, the merkle branch of the coinbase and the header fields.
+ *
+ * Beyond the 2^32 nonces of one header the search space is extended by "rolls": roll r sets
+ * ntime to ntime + r % (ntime_roll + 1) and extranonce2 to r / (ntime_roll + 1), so the cheap
+ * ntime changes (same merkle root, same midstate) come first.
+ */
+struct mining_job {
+    using hash_t = crypto::sha256::hash_t;
+    using header_t = std::array<unsigned char, 80>;
+
+    // job, extranonce, ntime and nonce that produced a share
+    struct share {
+        std::string job_id;
+        std::uint64_t extranonce2;
+        std::uint32_t ntime;
+        std::uint32_t nonce;
+    };
+
+    std::string id;
+    std::uint32_t version = 0;
+    hash_t prev_hash = {0};                 // header byte order
+    std::vector<unsigned char> coinbase1;
+    std::vector<unsigned char> extranonce1;
+    unsigned extranonce2_size = 4;
+    std::vector<unsigned char> coinbase2;
+    std::vector<hash_t> merkle_branch;      // sibling hashes from the coinbase up to the root
+    std::uint32_t ntime = 0;
+    std::uint32_t nbits = 0;
+    std::uint32_t ntime_roll = 0;           // how many seconds ntime may be moved forward
+    crypto::target256 target;               // a share's hash, as a little-endian number, must not exceed it
+
+    // number of (extranonce2, ntime) combinations, capped so roll << 32 | nonce fits 63 bits
+    std::uint64_t roll_count() const;
+
+    std::uint64_t extranonce2_of(std::uint64_t roll) const;
+
+    std::uint32_t ntime_of(std::uint64_t roll) const;
+
+    share solution(std::uint64_t roll, std::uint32_t nonce) const {
+        return { id, extranonce2_of(roll), ntime_of(roll), nonce };
+    }
+
+    // coinbase1 || extranonce1 || extranonce2 (little-endian, extranonce2_size bytes) || coinbase2
+    std::vector<unsigned char> coinbase(std::uint64_t extranonce2) const;
+
+    // SHA-256 state after the constant coinbase1 || extranonce1 prefix
+    crypto::sha256_inline coinbase_prefix() const;
+
+    // merkle root for the given extranonce2, starting from a coinbase_prefix() snapshot
+    hash_t merkle_root(const crypto::sha256_inline& prefix, std::uint64_t extranonce2) const;
+
+    hash_t merkle_root(std::uint64_t extranonce2) const {
+        return merkle_root(coinbase_prefix(), extranonce2);
+    }
+
+    // header with a zero nonce
+    header_t header(const hash_t& merkle_root, std::uint32_t ntime) const;
+};
+
+/*
+ * Miner job data that follows mining_job rolls.
+ *
+ * Satisfies the rolling contract of miner: roll_count(), rolled(roll) and solution(roll, nonce).
+ * Each worker keeps its own copy per roll; rolling ntime only rebuilds the header tail (ntime
+ * sits in the second header block, the midstate stays), while a new extranonce2 also recomputes
+ * the coinbase hash from the cached prefix state and walks the merkle branch (O(log n) hashes),
+ * then the midstate.
+ *
+ * @param Hasher header hashing policy constructible from a header_t, with reset() for a new
+ * header and reset_tail() for one that differs in bytes 64..79 only,
+ * e.g. crypto::sha256_lanes or crypto::header_hasher<>
+ */
+template<typename Hasher>
+class job_work final {
+public:
+    using header_t = mining_job::header_t;
+
+    explicit job_work(const mining_job& job)
+            : m_shared(std::make_shared<const shared>(job))
+              , m_merkle_root(m_shared->job.merkle_root(m_shared->prefix, 0))
+              , m_header(m_shared->job.header(m_merkle_root, m_shared->job.ntime))
+              , m_hasher(m_header) {
+    }
+
+    std::uint64_t roll_count() const {
+        return m_shared->job.roll_count();
+    }
+
+    job_work rolled(std::uint64_t roll) const {
+        job_work result = *this;
+        result.move_to(roll);
+        return result;
+    }
+
+    mining_job::share solution(std::uint64_t roll, std::uint32_t nonce) const {
+        return m_shared->job.solution(roll, nonce);
+    }
+
+    const mining_job& job() const {
+        return m_shared->job;
+    }
+
+    const header_t& header() const {
+        return m_header;
+    }
+
+    const Hasher& hasher() const {
+        return m_hasher;
+    }
+
+private:
+    struct shared {
+        explicit shared(const mining_job& job) : job(job), prefix(job.coinbase_prefix()) {}
+
+        mining_job job;
+        crypto::sha256_inline prefix;
+    };
+
+    void move_to(std::uint64_t roll) {
+        const auto& job = m_shared->job;
+        auto extranonce2 = job.extranonce2_of(roll);
+        if(extranonce2 == m_extranonce2) {
+            m_header = job.header(m_merkle_root, job.ntime_of(roll));
+            m_hasher.reset_tail(m_header);
+            return;
+        }
+        m_merkle_root = job.merkle_root(m_shared->prefix, extranonce2);
+        m_extranonce2 = extranonce2;
+        m_header = job.header(m_merkle_root, job.ntime_of(roll));
+        m_hasher.reset(m_header);
+    }
+
+    std::shared_ptr<const shared> m_shared;
+    std::uint64_t m_extranonce2 { 0 };
+    mining_job::hash_t m_merkle_root;
+    header_t m_header;
+    Hasher m_hasher;
+};
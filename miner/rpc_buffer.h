@@ -0,0 +1,57 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+/*
+ * Reply buffer of one JSON-RPC connection. It grows (by doubling) to the largest reply seen
+ * and is then reused, so steady-state requests append the reply chunks without allocating.
+ */
+struct rpc_buffer {
+    char *buf = nullptr;
+    std::size_t len = 0;
+    std::size_t cap = 0;
+
+    rpc_buffer() = default;
+    rpc_buffer(const rpc_buffer&) = delete;
+    rpc_buffer& operator=(const rpc_buffer&) = delete;
+
+    ~rpc_buffer() {
+        std::free(buf);
+    }
+
+    // empty and still NUL-terminated, so code reading buf as a C string sees no stale reply
+    void clear() {
+        len = 0;
+        if(buf)
+            buf[0] = 0;
+    }
+
+    // keeps the contents NUL-terminated; false when growing failed
+    bool append(const void *data, std::size_t size) {
+        if(len + size + 1 > cap) {
+            std::size_t grown = cap ? cap : 4096;
+            while(grown < len + size + 1)
+                grown *= 2;
+            auto bigger = static_cast<char *>(std::realloc(buf, grown));
+            if(!bigger)
+                return false;
+            buf = bigger;
+            cap = grown;
+        }
+        std::memcpy(buf + len, data, size);
+        len += size;
+        buf[len] = 0;
+        return true;
+    }
+
+    std::string_view view() const {
+        return { buf, len };
+    }
+};
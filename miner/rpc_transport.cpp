@@ -0,0 +1,192 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "rpc_transport.h"
+
+#include <algorithm>
+#include <future>
+
+#include <curl/curl.h>
+
+namespace {
+
+    constexpr int PollMilliseconds = 1000;
+
+    size_t append_response(char* data, size_t size, size_t count, void* user_data) {
+        static_cast<std::string*>(user_data)->append(data, size * count);
+        return size * count;
+    }
+
+}
+
+rpc_transport::rpc_transport(std::string url, std::string userpass, unsigned connections)
+        : m_url(std::move(url))
+          , m_userpass(std::move(userpass)) {
+    static std::once_flag global;
+    std::call_once(global, [] { curl_global_init(CURL_GLOBAL_ALL); });
+
+    m_multi = curl_multi_init();
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(connections));
+
+    auto headers = curl_slist_append(nullptr, "Content-Type: application/json");
+    m_headers = curl_slist_append(headers, "Expect:");
+
+    for(unsigned i = 0; i < std::max(connections, 1u); ++i) {
+        auto slot = std::make_unique<connection>();
+        slot->easy = curl_easy_init();
+        if(!slot->easy)
+            continue;
+        curl_easy_setopt(slot->easy, CURLOPT_URL, m_url.c_str());
+        curl_easy_setopt(slot->easy, CURLOPT_POST, 1L);
+        curl_easy_setopt(slot->easy, CURLOPT_HTTPHEADER, static_cast<curl_slist*>(m_headers));
+        curl_easy_setopt(slot->easy, CURLOPT_TCP_NODELAY, 1L);
+        curl_easy_setopt(slot->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(slot->easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(slot->easy, CURLOPT_WRITEFUNCTION, append_response);
+        curl_easy_setopt(slot->easy, CURLOPT_WRITEDATA, &slot->response);
+        curl_easy_setopt(slot->easy, CURLOPT_PRIVATE, slot.get());
+        if(!m_userpass.empty()) {
+            curl_easy_setopt(slot->easy, CURLOPT_USERPWD, m_userpass.c_str());
+            curl_easy_setopt(slot->easy, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+        }
+        m_connections.push_back(std::move(slot));
+    }
+
+    m_loop = std::thread([this] { loop(); });
+}
+
+rpc_transport::~rpc_transport() {
+    m_stop = true;
+    curl_multi_wakeup(m_multi);
+    m_loop.join();
+
+    std::deque<request> queued;
+    {
+        std::lock_guard lock(m_lock);
+        queued.swap(m_queue);
+    }
+    for(auto&& slot : m_connections) {
+        if(slot->active) {
+            curl_multi_remove_handle(m_multi, slot->easy);
+            queued.push_back(std::move(*slot->active));
+        }
+        curl_easy_cleanup(slot->easy);
+    }
+    for(auto&& pending : queued) {
+        response reply;
+        reply.error = "transport shut down";
+        reply.latency = std::chrono::steady_clock::now() - pending.queued;
+        complete(pending, {}, std::move(reply));
+    }
+    curl_multi_cleanup(m_multi);
+    curl_slist_free_all(static_cast<curl_slist*>(m_headers));
+}
+
+void rpc_transport::call(std::string method, std::string params, completion done, std::chrono::milliseconds timeout) {
+    request pending;
+    // the id is only there for the protocol: replies come back on the request's own connection
+    pending.body = "{\"jsonrpc\":\"1.0\",\"id\":0,\"method\":" + json::quote(method) + ",\"params\":" + params + "}";
+    pending.done = std::move(done);
+    pending.timeout = timeout;
+    pending.queued = std::chrono::steady_clock::now();
+    {
+        std::lock_guard lock(m_lock);
+        m_queue.push_back(std::move(pending));
+    }
+    curl_multi_wakeup(m_multi);
+}
+
+void rpc_transport::post(std::string body, raw_completion done, std::chrono::milliseconds timeout) {
+    request pending;
+    pending.body = std::move(body);
+    pending.raw_done = std::move(done);
+    pending.timeout = timeout;
+    pending.queued = std::chrono::steady_clock::now();
+    {
+        std::lock_guard lock(m_lock);
+        m_queue.push_back(std::move(pending));
+    }
+    curl_multi_wakeup(m_multi);
+}
+
+rpc_transport::response rpc_transport::call(std::string method, std::string params, std::chrono::milliseconds timeout) {
+    std::promise<response> reply;
+    auto result = reply.get_future();
+    call(std::move(method), std::move(params), [&reply](response&& done) { reply.set_value(std::move(done)); }, timeout);
+    return result.get();
+}
+
+void rpc_transport::loop() {
+    while(!m_stop) {
+        start_queued();
+
+        int running = 0;
+        curl_multi_perform(m_multi, &running);
+
+        int left = 0;
+        while(auto message = curl_multi_info_read(m_multi, &left)) {
+            if(message->msg != CURLMSG_DONE)
+                continue;
+            connection* slot = nullptr;
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &slot);
+            auto code = message->data.result;
+            curl_multi_remove_handle(m_multi, message->easy_handle);
+            finish(*slot, code);
+        }
+
+        curl_multi_poll(m_multi, nullptr, 0, PollMilliseconds, nullptr);
+    }
+}
+
+void rpc_transport::start_queued() {
+    std::lock_guard lock(m_lock);
+    for(auto&& slot : m_connections) {
+        if(m_queue.empty())
+            return;
+        if(slot->active)
+            continue;
+        slot->active.emplace(std::move(m_queue.front()));
+        m_queue.pop_front();
+        slot->response.clear();
+        curl_easy_setopt(slot->easy, CURLOPT_POSTFIELDS, slot->active->body.c_str());
+        curl_easy_setopt(slot->easy, CURLOPT_POSTFIELDSIZE, static_cast<long>(slot->active->body.size()));
+        curl_easy_setopt(slot->easy, CURLOPT_TIMEOUT_MS, static_cast<long>(slot->active->timeout.count()));
+        curl_multi_add_handle(m_multi, slot->easy);
+    }
+}
+
+void rpc_transport::finish(connection& slot, int code) {
+    auto pending = std::move(*slot.active);
+    slot.active.reset();
+
+    response reply;
+    curl_off_t transfer = 0;
+    curl_easy_getinfo(slot.easy, CURLINFO_TOTAL_TIME_T, &transfer);
+    reply.transfer = std::chrono::microseconds(transfer);
+
+    std::string_view body;
+    if(code != CURLE_OK) {
+        reply.error = curl_easy_strerror(static_cast<CURLcode>(code));
+    } else if(pending.raw_done) {
+        body = slot.response;
+    } else if(auto parsed = json::parse(slot.response); !parsed || !parsed->is_object()) {
+        // bitcoind answers errors with HTTP 500 and a JSON body, so only a missing body is an HTTP error
+        long status = 0;
+        curl_easy_getinfo(slot.easy, CURLINFO_RESPONSE_CODE, &status);
+        reply.error = "HTTP " + std::to_string(status) + ", no JSON-RPC reply";
+    } else if(const auto& failure = (*parsed)["error"]; !failure.is_null()) {
+        reply.error = failure["message"].is_string() ? failure["message"].as_string() : "JSON-RPC error";
+    } else {
+        reply.result = (*parsed)["result"];
+    }
+    reply.latency = std::chrono::steady_clock::now() - pending.queued;
+    complete(pending, body, std::move(reply));
+}
+
+void rpc_transport::complete(request& pending, std::string_view body, response&& reply) {
+    if(pending.raw_done)
+        pending.raw_done(body, std::move(reply));
+    else if(pending.done)
+        pending.done(std::move(reply));
+}
@@ -0,0 +1,105 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "json.h"
+
+typedef void CURL;
+typedef void CURLM;
+
+/*
+ * Non-blocking bitcoind-style JSON-RPC over HTTP on the curl multi interface.
+ *
+ * One event-loop thread drives every request. Up to `connections` requests are in flight at
+ * once on pooled easy handles that are configured once and keep their HTTP connections alive,
+ * so a slow getblocktemplate never holds up a submitblock queued behind it. Requests complete
+ * through a callback on the loop thread (keep it short), with their measured latency.
+ */
+class rpc_transport final {
+public:
+    struct response {
+        std::optional<json::value> result;      // "result", std::nullopt on failure
+        std::string error;                      // transport, HTTP or JSON-RPC error
+        std::chrono::nanoseconds latency { 0 }; // call() until the reply was parsed, queueing included
+        std::chrono::nanoseconds transfer { 0 };// the HTTP exchange alone
+    };
+
+    using completion = std::function<void(response&& reply)>;
+
+    // reply body as received (a batch reply, or text the caller scans itself), valid until it returns
+    using raw_completion = std::function<void(std::string_view body, response&& reply)>;
+
+    constexpr static std::chrono::seconds DefaultTimeout { 60 };
+
+    // userpass: "user:password" for HTTP basic authentication, empty for none
+    rpc_transport(std::string url, std::string userpass, unsigned connections = 4);
+
+    // fails every request still queued or in flight
+    ~rpc_transport();
+
+    rpc_transport(const rpc_transport&) = delete;
+    rpc_transport& operator=(const rpc_transport&) = delete;
+
+    // queues `method` with `params` (a JSON array text); `done` runs on the loop thread
+    void call(std::string method, std::string params, completion done, std::chrono::milliseconds timeout = DefaultTimeout);
+
+    // blocking form for callers with nothing else to do meanwhile, never from a completion
+    response call(std::string method, std::string params, std::chrono::milliseconds timeout = DefaultTimeout);
+
+    /*
+    * Sends `body` as it is (e.g. a JSON-RPC batch) and parses nothing: `done` gets the reply
+    * body, empty with reply.error set when the exchange failed. The body lives in the
+    * connection's buffer, which keeps its capacity from one request to the next.
+    */
+    void post(std::string body, raw_completion done, std::chrono::milliseconds timeout = DefaultTimeout);
+
+private:
+    struct request {
+        std::string body;
+        completion done;
+        raw_completion raw_done;                // set by post() instead of done
+        std::chrono::milliseconds timeout;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    struct connection {
+        CURL* easy = nullptr;
+        std::string response;
+        std::optional<request> active;
+    };
+
+    void loop();
+
+    // hands queued requests to idle connections, on the loop thread
+    void start_queued();
+
+    void finish(connection& slot, int code);
+
+    // runs the request's completion with `body` (post) or the parsed reply (call)
+    static void complete(request& pending, std::string_view body, response&& reply);
+
+    std::string m_url;
+    std::string m_userpass;
+    CURLM* m_multi = nullptr;
+    void* m_headers = nullptr;                  // curl_slist shared by every connection
+    std::vector<std::unique_ptr<connection>> m_connections;
+
+    std::mutex m_lock;
+    std::deque<request> m_queue;
+    std::atomic_bool m_stop { false };
+    std::thread m_loop;
+};
@@ -16,6 +16,7 @@ namespace crypto {
         virtual void transform(const unsigned char* data) = 0;     
         virtual const hash_t& finalize() = 0;      
         virtual const hash_t& hash() = 0;
+        virtual hash_t state() const = 0; // chaining value after the last transform, big-endian, no padding
     };
 
 }
\ No newline at end of file
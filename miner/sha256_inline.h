@@ -0,0 +1,115 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "sha256.h"
+#include "sha256_kernel.h"
+
+namespace crypto {
+
+    // compression policy: portable scalar kernel, fully inlinable
+    struct scalar_transform {
+        static void transform(std::uint32_t* state, const unsigned char* block) {
+            std::uint32_t w[16];
+            for(unsigned i = 0; i < 16; ++i)
+                w[i] = (std::uint32_t(block[i * 4]) << 24) | (std::uint32_t(block[i * 4 + 1]) << 16)
+                     | (std::uint32_t(block[i * 4 + 2]) << 8) | block[i * 4 + 3];
+            detail::compress(state, w);
+        }
+    };
+
+    /*
+    * Header-only SHA-256 with the whole state inside the object.
+    *
+    * Same member functions as crypto::sha256 but non-virtual, so it can be used as a
+    * compile-time hashing policy (e.g. crypto::header_hasher<crypto::sha256_inline>):
+    * no heap allocation, copies are plain memcpy snapshots and every call can be inlined.
+    *
+    * @param Transform compression policy, signature:
+    *    static void Transform::transform(std::uint32_t* state, const unsigned char* block);
+    */
+    template<typename Transform = scalar_transform>
+    class basic_sha256 final {
+    public:
+        using hash_t = sha256::hash_t;
+
+        basic_sha256() {
+            std::memcpy(m_state, detail::sha256_h, sizeof(m_state));
+        }
+
+        void update(const unsigned char* data, std::size_t length) {
+            auto used = static_cast<std::size_t>(m_length % 64);
+            m_length += length;
+
+            if(used != 0) {
+                auto fill = std::min<std::size_t>(64 - used, length);
+                std::memcpy(m_buffer + used, data, fill);
+                data += fill;
+                length -= fill;
+                if(used + fill < 64)
+                    return;
+                Transform::transform(m_state, m_buffer);
+            }
+
+            for(; length >= 64; data += 64, length -= 64)
+                Transform::transform(m_state, data);
+
+            std::memcpy(m_buffer, data, length);
+        }
+
+        // raw compression of one block, does not count towards the message length
+        void transform(const unsigned char* data) {
+            Transform::transform(m_state, data);
+        }
+
+        const hash_t& finalize() {
+            const std::uint64_t bits = m_length * 8;
+            auto used = static_cast<std::size_t>(m_length % 64);
+
+            m_buffer[used++] = 0x80;
+            if(used > 56) {
+                std::memset(m_buffer + used, 0, 64 - used);
+                Transform::transform(m_state, m_buffer);
+                used = 0;
+            }
+            std::memset(m_buffer + used, 0, 56 - used);
+            for(unsigned i = 0; i < 8; ++i)
+                m_buffer[63 - i] = static_cast<unsigned char>(bits >> (i * 8));
+            Transform::transform(m_state, m_buffer);
+
+            m_hash = state();
+            return m_hash;
+        }
+
+        const hash_t& hash() const {
+            return m_hash;
+        }
+
+        // chaining value after the last compression, big-endian, no padding
+        hash_t state() const {
+            hash_t result;
+            for(unsigned i = 0; i < 8; ++i) {
+                result[i * 4 + 0] = static_cast<unsigned char>(m_state[i] >> 24);
+                result[i * 4 + 1] = static_cast<unsigned char>(m_state[i] >> 16);
+                result[i * 4 + 2] = static_cast<unsigned char>(m_state[i] >> 8);
+                result[i * 4 + 3] = static_cast<unsigned char>(m_state[i]);
+            }
+            return result;
+        }
+
+    private:
+        std::uint32_t m_state[8];
+        unsigned char m_buffer[64];
+        std::uint64_t m_length { 0 };
+        hash_t m_hash = {0};
+    };
+
+    using sha256_inline = basic_sha256<>;
+
+}
@@ -0,0 +1,410 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Lane-generic SHA-256 compression used by the multi-buffer backends.
+ *
+ * V is either std::uint32_t (one lane) or a GCC/Clang vector of uint32 lanes. The same
+ * templates are compiled once per instruction set in sha256_lanes_<isa>.cpp with the
+ * matching -m flags, so a translation unit built for an ISA must only instantiate
+ * them with its own vector width.
+ */
+namespace crypto::detail {
+
+    using v4u32 = std::uint32_t __attribute__((vector_size(16)));
+    using v8u32 = std::uint32_t __attribute__((vector_size(32)));
+    using v16u32 = std::uint32_t __attribute__((vector_size(64)));
+
+    inline constexpr std::uint32_t sha256_k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    inline constexpr std::uint32_t sha256_h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    template<typename V>
+    constexpr unsigned lane_count = sizeof(V) / sizeof(std::uint32_t);
+
+    template<typename V>
+    inline V broadcast(std::uint32_t value) {
+        return V{} + value;
+    }
+
+    template<typename V>
+    constexpr V rotr(V x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    template<typename V>
+    inline V bswap(V x) {
+        return (x << 24) | ((x << 8) & 0x00ff0000) | ((x >> 8) & 0x0000ff00) | (x >> 24);
+    }
+
+    template<typename V>
+    inline V lane_index() {
+        V result{};
+        if constexpr (lane_count<V> > 1)
+            for(unsigned lane = 0; lane < lane_count<V>; ++lane)
+                result[lane] = lane;
+        return result;
+    }
+
+    template<typename V>
+    inline std::uint32_t lane(const V& v, unsigned index) {
+        if constexpr (lane_count<V> > 1)
+            return v[index];
+        else
+            return v;
+    }
+
+    template<typename V>
+    constexpr V big_sigma0(V x) {
+        return rotr(x, 2) ^ rotr(x, 13) ^ rotr(x, 22);
+    }
+
+    template<typename V>
+    constexpr V big_sigma1(V x) {
+        return rotr(x, 6) ^ rotr(x, 11) ^ rotr(x, 25);
+    }
+
+    template<typename V>
+    constexpr V small_sigma0(V x) {
+        return rotr(x, 7) ^ rotr(x, 18) ^ (x >> 3);
+    }
+
+    template<typename V>
+    constexpr V small_sigma1(V x) {
+        return rotr(x, 17) ^ rotr(x, 19) ^ (x >> 10);
+    }
+
+    template<typename V>
+    constexpr V choose(V e, V f, V g) {
+        return (e & f) ^ (~e & g);
+    }
+
+    template<typename V>
+    constexpr V majority(V a, V b, V c) {
+        return (a & b) ^ (a & c) ^ (b & c);
+    }
+
+    // message schedule step for round i >= 16, w is a 16-word ring
+    template<typename V>
+    inline void schedule(V* w, unsigned i) {
+        auto w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+        w[i & 15] += small_sigma0(w15) + small_sigma1(w2) + w[(i - 7) & 15];
+    }
+
+    // rounds first .. last - 1 over the working variables s[0..7] = a..h
+    template<typename V>
+    inline void rounds(V* s, V* w, unsigned first, unsigned last) {
+        V a = s[0], b = s[1], c = s[2], d = s[3];
+        V e = s[4], f = s[5], g = s[6], h = s[7];
+
+        for(unsigned i = first; i < last; ++i) {
+            if(i >= 16)
+                schedule(w, i);
+            auto t1 = h + big_sigma1(e) + choose(e, f, g) + sha256_k[i] + w[i & 15];
+            auto t2 = big_sigma0(a) + majority(a, b, c);
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+        s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+    }
+
+    // state += compress(state, w); w holds the 16 message words and is clobbered by the schedule
+    template<typename V>
+    inline void compress(V* state, V* w) {
+        V s[8];
+        for(unsigned i = 0; i < 8; ++i)
+            s[i] = state[i];
+        rounds(s, w, 0, 64);
+        for(unsigned i = 0; i < 8; ++i)
+            state[i] += s[i];
+    }
+
+    /*
+    * Second header block per job.
+    *
+    * Of its 16 message words only w[3], the nonce, changes per attempt: w[0..2] are the end
+    * of the merkle root, ntime and nbits, the rest is the padding of an 80-byte message.
+    * Rounds 0..2 read nothing but w[0..2], round 3 adds w[3] to otherwise constant sums, and
+    * each schedule word w[16..63] is a sum of four terms, those on constant words constant
+    * as well. prepare_header() computes all of that once per header; the kernels add just the
+    * nonce-dependent terms, picked at compile time from header_words.
+    */
+    struct header_schedule {
+        std::uint32_t midstate[8];
+        std::uint32_t tail[3];      // header words 16..18 as big-endian message words
+        std::uint32_t state[8];     // a..h entering round 3
+        std::uint32_t t1;           // T1 of round 3 without its w[3] term
+        std::uint32_t t2;           // T2 of round 3
+        std::uint32_t fixed[64];    // K[i] + w[i] of constant words, the constant terms of varying words
+    };
+
+    void prepare_header(const std::uint32_t* midstate, const std::uint32_t* tail, header_schedule& job);
+
+    // one round on s[0..7] = a..h, kw = K[i] + w[i]
+    template<typename V>
+    [[gnu::always_inline]] inline void round(V* s, V kw) {
+        const auto t1 = s[7] + big_sigma1(s[4]) + choose(s[4], s[5], s[6]) + kw;
+        const auto t2 = big_sigma0(s[0]) + majority(s[0], s[1], s[2]);
+        s[7] = s[6]; s[6] = s[5]; s[5] = s[4]; s[4] = s[3] + t1;
+        s[3] = s[2]; s[2] = s[1]; s[1] = s[0]; s[0] = t1 + t2;
+    }
+
+    /*
+    * f(std::integral_constant<unsigned, I>{}) for I = First .. Last - 1, unrolled at compile time.
+    * Everything has to be inlined into one body (f too, so mark it always_inline) for the
+    * working variables and schedule words to stay in registers.
+    */
+    template<unsigned First, unsigned Last, typename F>
+    [[gnu::always_inline]] inline void unroll(F&& f) {
+        [&]<unsigned... I>(std::integer_sequence<unsigned, I...>) __attribute__((always_inline)) {
+            (f(std::integral_constant<unsigned, First + I> {}), ...);
+        }(std::make_integer_sequence<unsigned, Last - First> {});
+    }
+
+    // what a message schedule word is made of
+    enum class word_kind : unsigned char {
+        zero,       // always 0
+        fixed,      // the same for every call
+        varying     // changes with the per-call words
+    };
+
+    using schedule_kinds = std::array<word_kind, 64>;
+
+    // kinds of all 64 schedule words, given those of the 16 message words
+    constexpr schedule_kinds schedule_words(const std::array<word_kind, 16>& message) {
+        schedule_kinds result {};
+        for(unsigned i = 0; i < 64; ++i) {
+            if(i < 16) {
+                result[i] = message[i];
+                continue;
+            }
+            const word_kind sources[] = { result[i - 2], result[i - 7], result[i - 15], result[i - 16] };
+            result[i] = word_kind::zero;
+            for(auto kind : sources)
+                if(kind > result[i])
+                    result[i] = kind;
+        }
+        return result;
+    }
+
+    // whether any of the terms of schedule word i >= 16 is a fixed word
+    constexpr bool has_fixed_terms(const schedule_kinds& kinds, unsigned i) {
+        return kinds[i - 2] == word_kind::fixed || kinds[i - 7] == word_kind::fixed
+               || kinds[i - 15] == word_kind::fixed || kinds[i - 16] == word_kind::fixed;
+    }
+
+    /*
+    * Constant parts of the schedule of a message: for i >= 16, fixed[i] is the sum of the
+    * terms of w[i] on non-varying words; fixed words of w also get their value. w holds the
+    * 16 message words (varying ones ignored) and room for 64.
+    */
+    constexpr void fixed_schedule(const schedule_kinds& kinds, std::uint32_t* w, std::uint32_t* fixed) {
+        for(unsigned i = 16; i < 64; ++i) {
+            std::uint32_t sum = 0;
+            if(kinds[i - 2] != word_kind::varying)
+                sum += small_sigma1(w[i - 2]);
+            if(kinds[i - 7] != word_kind::varying)
+                sum += w[i - 7];
+            if(kinds[i - 15] != word_kind::varying)
+                sum += small_sigma0(w[i - 15]);
+            if(kinds[i - 16] != word_kind::varying)
+                sum += w[i - 16];
+            fixed[i] = sum;
+            w[i] = kinds[i] == word_kind::varying ? 0 : sum;
+        }
+    }
+
+    // varying schedule word I >= 16: the constant terms `fixed` plus the varying ones
+    template<const schedule_kinds& Kinds, unsigned I, typename V>
+    [[gnu::always_inline]] inline V schedule_word(const V* w, std::uint32_t fixed) {
+        V value = has_fixed_terms(Kinds, I) ? broadcast<V>(fixed) : V{};
+        if constexpr(Kinds[I - 2] == word_kind::varying)
+            value += small_sigma1(w[I - 2]);
+        if constexpr(Kinds[I - 7] == word_kind::varying)
+            value += w[I - 7];
+        if constexpr(Kinds[I - 15] == word_kind::varying)
+            value += small_sigma0(w[I - 15]);
+        if constexpr(Kinds[I - 16] == word_kind::varying)
+            value += w[I - 16];
+        return value;
+    }
+
+    inline constexpr schedule_kinds header_words = schedule_words({
+        word_kind::fixed, word_kind::fixed, word_kind::fixed, word_kind::varying,
+        word_kind::fixed, word_kind::zero, word_kind::zero, word_kind::zero,
+        word_kind::zero, word_kind::zero, word_kind::zero, word_kind::zero,
+        word_kind::zero, word_kind::zero, word_kind::zero, word_kind::fixed
+    });
+
+    // the second hash hashes the 32-byte first hash: words 0..7 vary, the padding is a compile-time constant
+    inline constexpr schedule_kinds hash1_words = schedule_words({
+        word_kind::varying, word_kind::varying, word_kind::varying, word_kind::varying,
+        word_kind::varying, word_kind::varying, word_kind::varying, word_kind::varying,
+        word_kind::fixed, word_kind::zero, word_kind::zero, word_kind::zero,
+        word_kind::zero, word_kind::zero, word_kind::zero, word_kind::fixed
+    });
+
+    // constant parts of the second hash, and T1 (without w[0]) and T2 of its round 0 from the initial state
+    struct hash1_schedule {
+        std::uint32_t fixed[64];
+        std::uint32_t t1;
+        std::uint32_t t2;
+    };
+
+    inline constexpr hash1_schedule hash1_constants = [] {
+        hash1_schedule result {};
+        std::uint32_t w[64] = {0, 0, 0, 0, 0, 0, 0, 0, 0x80000000, 0, 0, 0, 0, 0, 0, 32 * 8};
+        for(unsigned i = 8; i < 16; ++i)
+            result.fixed[i] = sha256_k[i] + w[i];
+        fixed_schedule(hash1_words, w, result.fixed);
+        const auto* h = sha256_h;
+        result.t1 = h[7] + big_sigma1(h[4]) + choose(h[4], h[5], h[6]) + sha256_k[0];
+        result.t2 = big_sigma0(h[0]) + majority(h[0], h[1], h[2]);
+        return result;
+    }();
+
+    // first hash of the header for one nonce per lane, written to hash1[0..7]
+    template<typename V>
+    [[gnu::always_inline]] inline void first_hash(const header_schedule& job, V nonce, V* hash1) {
+        V w[64], s[8];
+        w[3] = bswap(nonce);
+        for(unsigned i = 0; i < 8; ++i)
+            s[i] = broadcast<V>(job.state[i]);
+
+        const auto t1 = broadcast<V>(job.t1) + w[3];
+        s[7] = s[6]; s[6] = s[5]; s[5] = s[4]; s[4] = s[3] + t1;
+        s[3] = s[2]; s[2] = s[1]; s[1] = s[0]; s[0] = t1 + broadcast<V>(job.t2);
+
+        unroll<4, 64>([&](auto index) __attribute__((always_inline)) {
+            constexpr unsigned i = index;
+            if constexpr(header_words[i] == word_kind::zero) {
+                round(s, broadcast<V>(sha256_k[i]));
+            } else if constexpr(header_words[i] == word_kind::fixed) {
+                round(s, broadcast<V>(job.fixed[i]));
+            } else {
+                w[i] = schedule_word<header_words, i>(w, job.fixed[i]);
+                round(s, w[i] + sha256_k[i]);
+            }
+        });
+
+        for(unsigned i = 0; i < 8; ++i)
+            hash1[i] = s[i] + job.midstate[i];
+    }
+
+    /*
+    * Rounds 0 .. Rounds - 1 of the second hash over w[0..7] = the first hash, into s = a..h.
+    * Round 0 starts from the constant initial state, so it only adds w[0].
+    */
+    template<unsigned Rounds, typename V>
+    [[gnu::always_inline]] inline void second_hash(V* w, V* s) {
+        const auto& constants = hash1_constants;
+        const auto t1 = w[0] + constants.t1;
+        s[7] = broadcast<V>(sha256_h[6]); s[6] = broadcast<V>(sha256_h[5]);
+        s[5] = broadcast<V>(sha256_h[4]); s[4] = t1 + sha256_h[3];
+        s[3] = broadcast<V>(sha256_h[2]); s[2] = broadcast<V>(sha256_h[1]);
+        s[1] = broadcast<V>(sha256_h[0]); s[0] = t1 + constants.t2;
+
+        unroll<1, Rounds>([&](auto index) __attribute__((always_inline)) {
+            constexpr unsigned i = index;
+            if constexpr(hash1_words[i] == word_kind::zero) {
+                round(s, broadcast<V>(sha256_k[i]));
+            } else if constexpr(hash1_words[i] == word_kind::fixed) {
+                round(s, broadcast<V>(constants.fixed[i]));
+            } else {
+                if constexpr(i >= 16)
+                    w[i] = schedule_word<hash1_words, i>(w, constants.fixed[i]);
+                round(s, w[i] + sha256_k[i]);
+            }
+        });
+    }
+
+    /*
+    * Double SHA-256 of an 80-byte header, one header per lane.
+    *
+    * @param job the header prepared by prepare_header()
+    * @param nonce per-lane nonce, stored in the header in host byte order
+    * @param digest receives the final state words (big-endian digest words)
+    */
+    template<typename V>
+    inline void sha256d_header(const header_schedule& job, V nonce, V* digest) {
+        V w[64], s[8];
+        first_hash(job, nonce, w);
+        second_hash<64>(w, s);
+        for(unsigned i = 0; i < 8; ++i)
+            digest[i] = s[i] + sha256_h[i];
+    }
+
+    /*
+    * Most significant 32 bits of the double SHA-256, reading the digest as a little-endian
+    * 256-bit number the way difficulty targets are compared: digest bytes 28..31.
+    * A header can only meet a target whose top 32 bits are >= this value.
+    *
+    * h after round 63 is the e produced by round 60, so rounds 61..63, their schedule
+    * words and the other seven output additions are skipped.
+    */
+    template<typename V>
+    inline V sha256d_header_top(const header_schedule& job, V nonce) {
+        V w[64], s[8];
+        first_hash(job, nonce, w);
+        second_hash<61>(w, s);
+        return bswap(s[4] + sha256_h[7]);
+    }
+
+    // hashes nonces first_nonce .. first_nonce + count - 1, count must be a multiple of the lane count
+    template<typename V>
+    inline void sha256d_headers(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count) {
+        for(unsigned base = 0; base < count; base += lane_count<V>) {
+            V digest[8];
+            sha256d_header(job, lane_index<V>() + (first_nonce + base), digest);
+            for(unsigned l = 0; l < lane_count<V>; ++l)
+                for(unsigned i = 0; i < 8; ++i)
+                    out[base + l][i] = lane(digest[i], l);
+        }
+    }
+
+    // top 32 bits (see sha256d_header_top) for nonces first_nonce .. first_nonce + count - 1
+    template<typename V>
+    inline void sha256d_headers_top(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count) {
+        for(unsigned base = 0; base < count; base += lane_count<V>) {
+            auto top = sha256d_header_top(job, lane_index<V>() + (first_nonce + base));
+            for(unsigned l = 0; l < lane_count<V>; ++l)
+                out[base + l] = lane(top, l);
+        }
+    }
+
+    // per-ISA entry points, defined in sha256_lanes_<isa>.cpp
+    void sha256d_headers_sse41(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count);
+    void sha256d_headers_avx2(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count);
+    void sha256d_headers_avx512(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count);
+    void sha256d_headers_shani(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count);
+
+    void sha256d_headers_top_sse41(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count);
+    void sha256d_headers_top_avx2(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count);
+    void sha256d_headers_top_avx512(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count);
+    void sha256d_headers_top_shani(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count);
+
+    // state += compress(state, block) on the SHA extensions, block is 64 message bytes
+    void sha256_transform_shani(std::uint32_t* state, const unsigned char* block);
+
+}
@@ -0,0 +1,176 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "sha256_lanes.h"
+#include "sha256_kernel.h"
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+namespace crypto {
+
+    namespace detail {
+
+        void prepare_header(const std::uint32_t* midstate, const std::uint32_t* tail, header_schedule& job) {
+            std::uint32_t w[64] = {tail[0], tail[1], tail[2], 0, 0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 80 * 8};
+            for(unsigned i = 0; i < 16; ++i)
+                job.fixed[i] = sha256_k[i] + w[i];
+            fixed_schedule(header_words, w, job.fixed);
+            for(unsigned i = 16; i < 64; ++i)
+                if(header_words[i] == word_kind::fixed)
+                    job.fixed[i] += sha256_k[i];
+
+            std::uint32_t s[8];
+            for(unsigned i = 0; i < 8; ++i)
+                s[i] = job.midstate[i] = midstate[i];
+            for(unsigned i = 0; i < 3; ++i) {
+                job.tail[i] = tail[i];
+                round(s, job.fixed[i]);
+            }
+            for(unsigned i = 0; i < 8; ++i)
+                job.state[i] = s[i];
+            job.t1 = s[7] + big_sigma1(s[4]) + choose(s[4], s[5], s[6]) + sha256_k[3];
+            job.t2 = big_sigma0(s[0]) + majority(s[0], s[1], s[2]);
+        }
+
+    }
+
+    namespace {
+
+        using backend_function = void (*)(const detail::header_schedule&, std::uint32_t, std::uint32_t (*)[8], unsigned);
+        using top_function = void (*)(const detail::header_schedule&, std::uint32_t, std::uint32_t*, unsigned);
+
+        struct backend_entry {
+            const char* name;
+            backend_function function;
+            top_function top;
+        };
+
+        void sha256d_headers_scalar(const detail::header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count) {
+            detail::sha256d_headers<std::uint32_t>(job, first_nonce, out, count);
+        }
+
+        void sha256d_headers_top_scalar(const detail::header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count) {
+            detail::sha256d_headers_top<std::uint32_t>(job, first_nonce, out, count);
+        }
+
+        // hashes per second of a backend on a fixed header, a few milliseconds of work
+        double calibrate(const backend_entry& entry) {
+            constexpr unsigned rounds = 1024;
+            const std::uint32_t midstate[8] = {0}, tail[3] = {0};
+            detail::header_schedule job;
+            detail::prepare_header(midstate, tail, job);
+            std::uint32_t out[sha256_lanes::batch_size];
+
+            auto start = std::chrono::steady_clock::now();
+            for(unsigned i = 0; i < rounds; ++i)
+                entry.top(job, i * sha256_lanes::batch_size, out, sha256_lanes::batch_size);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return rounds * sha256_lanes::batch_size / std::max(elapsed.count(), 1e-9);
+        }
+
+        // the fastest backend this CPU supports; which SIMD width beats the SHA extensions differs between cores
+        backend_entry select_backend() {
+            std::vector<backend_entry> candidates;
+#if defined(__x86_64__) || defined(__i386__)
+            const auto& features = cpu_features::get();
+            if(features.sha)
+                candidates.push_back({"sha-ni", detail::sha256d_headers_shani, detail::sha256d_headers_top_shani});
+            if(features.avx512f)
+                candidates.push_back({"avx512", detail::sha256d_headers_avx512, detail::sha256d_headers_top_avx512});
+            if(features.avx2)
+                candidates.push_back({"avx2", detail::sha256d_headers_avx2, detail::sha256d_headers_top_avx2});
+            if(features.sse41)
+                candidates.push_back({"sse4.1", detail::sha256d_headers_sse41, detail::sha256d_headers_top_sse41});
+#endif
+            if(candidates.empty())
+                return {"scalar", sha256d_headers_scalar, sha256d_headers_top_scalar};
+
+            backend_entry best = candidates.front();
+            double best_rate = candidates.size() > 1 ? calibrate(best) : 0;
+            for(std::size_t i = 1; i < candidates.size(); ++i) {
+                auto rate = calibrate(candidates[i]);
+                if(rate > best_rate) {
+                    best = candidates[i];
+                    best_rate = rate;
+                }
+            }
+            return best;
+        }
+
+        const backend_entry& active_backend() {
+            static const backend_entry entry = select_backend();
+            return entry;
+        }
+
+        std::uint32_t load_be32(const unsigned char* p) {
+            return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+        }
+
+    }
+
+    sha256_lanes::sha256_lanes(const header_t& header) {
+        reset(header);
+    }
+
+    void sha256_lanes::reset(const header_t& header) {
+        std::uint32_t w[16], midstate[8], tail[3];
+        for(unsigned i = 0; i < 16; ++i)
+            w[i] = load_be32(header.data() + i * 4);
+        for(unsigned i = 0; i < 8; ++i)
+            midstate[i] = detail::sha256_h[i];
+        detail::compress(midstate, w);
+
+        for(unsigned i = 0; i < 3; ++i)
+            tail[i] = load_be32(header.data() + 64 + i * 4);
+        detail::prepare_header(midstate, tail, m_job);
+    }
+
+    void sha256_lanes::reset_tail(const header_t& header) {
+        std::uint32_t midstate[8], tail[3];
+        std::memcpy(midstate, m_job.midstate, sizeof(midstate));
+        for(unsigned i = 0; i < 3; ++i)
+            tail[i] = load_be32(header.data() + 64 + i * 4);
+        detail::prepare_header(midstate, tail, m_job);
+    }
+
+    void sha256_lanes::compute(std::uint32_t first_nonce, batch_t& out) const {
+        std::uint32_t digest[batch_size][8];
+        active_backend().function(m_job, first_nonce, digest, batch_size);
+
+        for(unsigned n = 0; n < batch_size; ++n)
+            for(unsigned i = 0; i < 8; ++i) {
+                out[n][i * 4 + 0] = static_cast<unsigned char>(digest[n][i] >> 24);
+                out[n][i * 4 + 1] = static_cast<unsigned char>(digest[n][i] >> 16);
+                out[n][i * 4 + 2] = static_cast<unsigned char>(digest[n][i] >> 8);
+                out[n][i * 4 + 3] = static_cast<unsigned char>(digest[n][i]);
+            }
+    }
+
+    void sha256_lanes::probe(std::uint32_t first_nonce, top_batch_t& out) const {
+        active_backend().top(m_job, first_nonce, out.data(), batch_size);
+    }
+
+    sha256_lanes::hash_t sha256_lanes::compute_one(std::uint32_t nonce) const {
+        std::uint32_t digest[1][8];
+        sha256d_headers_scalar(m_job, nonce, digest, 1);
+
+        hash_t out;
+        for(unsigned i = 0; i < 8; ++i) {
+            out[i * 4 + 0] = static_cast<unsigned char>(digest[0][i] >> 24);
+            out[i * 4 + 1] = static_cast<unsigned char>(digest[0][i] >> 16);
+            out[i * 4 + 2] = static_cast<unsigned char>(digest[0][i] >> 8);
+            out[i * 4 + 3] = static_cast<unsigned char>(digest[0][i]);
+        }
+        return out;
+    }
+
+    const char* sha256_lanes::backend() {
+        return active_backend().name;
+    }
+
+}
@@ -0,0 +1,70 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "sha256.h"
+#include "sha256_kernel.h"
+
+namespace crypto {
+
+    /*
+    * Multi-buffer double SHA-256 of an 80-byte header over a batch of consecutive nonces.
+    *
+    * Each SIMD lane hashes its own nonce; the backend (SHA extensions, AVX-512 x16, AVX2 x8,
+    * SSE4.1 x4 or scalar) is chosen once at startup: the fastest one CPUID reports as supported. Every backend fills the same
+    * batch_size hashes per call, so callers do not depend on the lane width.
+    */
+    class sha256_lanes final {
+    public:
+        constexpr static unsigned batch_size = 16;
+        using header_t = std::array<unsigned char, 80>;
+        using hash_t = sha256::hash_t;
+        using batch_t = std::array<hash_t, batch_size>;
+        using top_batch_t = std::array<std::uint32_t, batch_size>;
+
+        explicit sha256_lanes(const header_t& header);
+
+        void reset(const header_t& header);
+
+        // only header bytes 64..79 (merkle root tail, ntime, nbits) changed: keeps the midstate
+        void reset_tail(const header_t& header);
+
+        // hashes of the header with nonces first_nonce .. first_nonce + batch_size - 1
+        void compute(std::uint32_t first_nonce, batch_t& out) const;
+
+        batch_t compute(std::uint32_t first_nonce) const {
+            batch_t out;
+            compute(first_nonce, out);
+            return out;
+        }
+
+        /*
+        * Check-only mode: the most significant 32 bits of each hash, read as a little-endian
+        * 256-bit number like difficulty targets (digest bytes 28..31). The second hash stops
+        * after the rounds that feed this word, so only nonces whose top bits fit the target
+        * need their full digest from compute_one().
+        */
+        void probe(std::uint32_t first_nonce, top_batch_t& out) const;
+
+        top_batch_t probe(std::uint32_t first_nonce) const {
+            top_batch_t out;
+            probe(first_nonce, out);
+            return out;
+        }
+
+        // full double SHA-256 for a single nonce, e.g. a candidate reported by probe()
+        hash_t compute_one(std::uint32_t nonce) const;
+
+        // name of the backend selected for this CPU
+        static const char* backend();
+
+    private:
+        detail::header_schedule m_job;      // midstate and the nonce-invariant part of the second block
+    };
+
+}
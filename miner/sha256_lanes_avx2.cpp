@@ -0,0 +1,19 @@
+/* 
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "sha256_kernel.h"
+
+namespace crypto::detail {
+
+#if defined(__AVX2__)
+    void sha256d_headers_avx2(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count) {
+        sha256d_headers<v8u32>(job, first_nonce, out, count);
+    }
+
+    void sha256d_headers_top_avx2(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count) {
+        sha256d_headers_top<v8u32>(job, first_nonce, out, count);
+    }
+#endif
+
+}
@@ -0,0 +1,98 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "sha256_kernel.h"
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+namespace crypto::detail {
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+    namespace {
+
+        // state += compress(state, w) on the SHA extensions, w are 16 message words in host order
+        inline void compress_shani(std::uint32_t* state, const std::uint32_t* w) {
+            __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+            __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+            tmp = _mm_shuffle_epi32(tmp, 0xb1);                 // CDAB
+            state1 = _mm_shuffle_epi32(state1, 0x1b);           // EFGH
+            __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   // ABEF
+            state1 = _mm_blend_epi16(state1, tmp, 0xf0);        // CDGH
+
+            const __m128i abef = state0;
+            const __m128i cdgh = state1;
+
+            __m128i msg[4];
+            for(unsigned i = 0; i < 4; ++i)
+                msg[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i * 4));
+
+            // 16 groups of 4 rounds; msg[] rotates through the schedule, 4 words per group
+#pragma GCC unroll 16
+            for(unsigned i = 0; i < 16; ++i) {
+                const __m128i current = msg[i % 4];
+                __m128i m = _mm_add_epi32(current, _mm_loadu_si128(reinterpret_cast<const __m128i*>(sha256_k + i * 4)));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+                if(i >= 3 && i <= 14) {
+                    __m128i next = _mm_add_epi32(msg[(i + 1) % 4], _mm_alignr_epi8(current, msg[(i + 3) % 4], 4));
+                    msg[(i + 1) % 4] = _mm_sha256msg2_epu32(next, current);
+                }
+                m = _mm_shuffle_epi32(m, 0x0e);
+                state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+                if(i >= 1 && i <= 12)
+                    msg[(i + 3) % 4] = _mm_sha256msg1_epu32(msg[(i + 3) % 4], current);
+            }
+
+            state0 = _mm_add_epi32(state0, abef);
+            state1 = _mm_add_epi32(state1, cdgh);
+
+            tmp = _mm_shuffle_epi32(state0, 0x1b);              // FEBA
+            state1 = _mm_shuffle_epi32(state1, 0xb1);           // DCHG
+            state0 = _mm_blend_epi16(tmp, state1, 0xf0);        // DCBA
+            state1 = _mm_alignr_epi8(state1, tmp, 8);           // ABEF
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+        }
+
+    }
+
+    void sha256_transform_shani(std::uint32_t* state, const unsigned char* block) {
+        std::uint32_t w[16];
+        for(unsigned i = 0; i < 16; ++i)
+            w[i] = (std::uint32_t(block[i * 4]) << 24) | (std::uint32_t(block[i * 4 + 1]) << 16)
+                 | (std::uint32_t(block[i * 4 + 2]) << 8) | block[i * 4 + 3];
+        compress_shani(state, w);
+    }
+
+    // the SHA extensions run the schedule in hardware (sha256msg1/2), so only the midstate and tail of the job are used
+    void sha256d_headers_shani(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t (*out)[8], unsigned count) {
+        const auto* tail = job.tail;
+        std::uint32_t block[16] = {tail[0], tail[1], tail[2], 0, 0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 80 * 8};
+        std::uint32_t hash1[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0x80000000, 0, 0, 0, 0, 0, 0, 32 * 8};
+
+        for(unsigned n = 0; n < count; ++n) {
+            block[3] = __builtin_bswap32(first_nonce + n);
+            for(unsigned i = 0; i < 8; ++i)
+                hash1[i] = job.midstate[i];
+            compress_shani(hash1, block);
+
+            for(unsigned i = 0; i < 8; ++i)
+                out[n][i] = sha256_h[i];
+            compress_shani(out[n], hash1);
+        }
+    }
+
+    // rnds2 works on pairs of rounds and keeps a..h interleaved, so there is no early exit here
+    void sha256d_headers_top_shani(const header_schedule& job, std::uint32_t first_nonce, std::uint32_t* out, unsigned count) {
+        std::uint32_t digest[8];
+        for(unsigned n = 0; n < count; ++n) {
+            sha256d_headers_shani(job, first_nonce + n, &digest, 1);
+            out[n] = __builtin_bswap32(digest[7]);
+        }
+    }
+#endif
+
+}
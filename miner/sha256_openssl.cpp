@@ -8,9 +8,25 @@ namespace crypto {
         SHA256_Init(m_context);
     }
 
-    sha256_openssl::sha256_openssl(const sha256_openssl& rhs){
-        m_context = new SHA256state_st;
-        *m_context = *rhs.m_context;
+    // a finalized rhs has released its context, the copy is finalized as well
+    sha256_openssl::sha256_openssl(const sha256_openssl& rhs) : m_hash(rhs.m_hash) {
+        if(rhs.m_context != nullptr)
+            m_context = new SHA256state_st(*rhs.m_context);
+    }
+
+    sha256_openssl& sha256_openssl::operator=(const sha256_openssl& rhs){
+        if(this != &rhs) {
+            if(rhs.m_context == nullptr) {
+                delete m_context;
+                m_context = nullptr;
+            } else if(m_context == nullptr) {
+                m_context = new SHA256state_st(*rhs.m_context);
+            } else {
+                *m_context = *rhs.m_context;
+            }
+            m_hash = rhs.m_hash;
+        }
+        return *this;
     }
 
     sha256_openssl::~sha256_openssl() noexcept {
@@ -32,12 +48,26 @@ namespace crypto {
     const sha256::hash_t& sha256_openssl::finalize() {
         if(m_context != nullptr) {
             SHA256_Final(m_hash.data(), m_context);
+            delete m_context;
             m_context = nullptr;
-            return m_hash;
         }
+        return m_hash;
     }
 
     const sha256::hash_t& sha256_openssl::hash() {
         return m_hash;
     }
+
+    sha256::hash_t sha256_openssl::state() const {
+        hash_t result = {0};
+        if(m_context != nullptr) {
+            for(unsigned i = 0; i < 8; ++i) {
+                result[i * 4 + 0] = static_cast<unsigned char>(m_context->h[i] >> 24);
+                result[i * 4 + 1] = static_cast<unsigned char>(m_context->h[i] >> 16);
+                result[i * 4 + 2] = static_cast<unsigned char>(m_context->h[i] >> 8);
+                result[i * 4 + 3] = static_cast<unsigned char>(m_context->h[i]);
+            }
+        }
+        return result;
+    }
 }
\ No newline at end of file
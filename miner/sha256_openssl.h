@@ -14,6 +14,7 @@ namespace crypto {
     public:
         sha256_openssl();
         sha256_openssl(const sha256_openssl& rhs);
+        sha256_openssl& operator=(const sha256_openssl& rhs);
         virtual ~sha256_openssl();
 
         virtual void update(const unsigned char* data, std::size_t length) override; //update
@@ -23,6 +24,8 @@ namespace crypto {
         virtual const hash_t& finalize() override; //finalize
 
         virtual const hash_t& hash() override; //getter
+
+        virtual hash_t state() const override; //midstate getter
     private:
         SHA256state_st* m_context { nullptr };
         hash_t m_hash = {0};
@@ -0,0 +1,59 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "sha256_shani.h"
+#include "sha256_kernel.h"
+#include "cpu_features.h"
+
+namespace crypto {
+
+    namespace {
+
+        using transform_function = void (*)(std::uint32_t*, const unsigned char*);
+
+        transform_function select_transform() {
+#if defined(__x86_64__) || defined(__i386__)
+            if(cpu_features::get().sha)
+                return detail::sha256_transform_shani;
+#endif
+            return scalar_transform::transform;
+        }
+
+        // chosen on first use, so hashing during static initialization of other units is safe
+        transform_function active_transform() {
+            static const transform_function transform = select_transform();
+            return transform;
+        }
+
+    }
+
+    void shani_transform::transform(std::uint32_t* state, const unsigned char* block) {
+        active_transform()(state, block);
+    }
+
+    bool shani_transform::accelerated() {
+        return active_transform() != scalar_transform::transform;
+    }
+
+    void sha256_shani::update(const unsigned char* data, std::size_t length) {
+        m_impl.update(data, length);
+    }
+
+    void sha256_shani::transform(const unsigned char* data) {
+        m_impl.transform(data);
+    }
+
+    const sha256::hash_t& sha256_shani::finalize() {
+        return m_impl.finalize();
+    }
+
+    const sha256::hash_t& sha256_shani::hash() {
+        return m_impl.hash();
+    }
+
+    sha256::hash_t sha256_shani::state() const {
+        return m_impl.state();
+    }
+
+}
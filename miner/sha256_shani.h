@@ -0,0 +1,74 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "sha256.h"
+#include "sha256_inline.h"
+
+namespace crypto {
+
+    // compression policy: SHA extensions when the CPU has them, scalar kernel otherwise
+    struct shani_transform {
+        static void transform(std::uint32_t* state, const unsigned char* block);
+
+        // true when compressions run on the SHA extensions
+        static bool accelerated();
+    };
+
+#if defined(__x86_64__) || defined(__i386__)
+    // compression policy: straight to the SHA extensions, for code already dispatched on accelerated()
+    struct shani_direct_transform {
+        static void transform(std::uint32_t* state, const unsigned char* block) {
+            detail::sha256_transform_shani(state, block);
+        }
+    };
+#endif
+
+    /*
+    * Calls work(std::type_identity<Transform>{}) with the compression policy this CPU supports.
+    * The CPU is checked once here rather than per block, so code templated on the policy (a
+    * job's nonce loop, a miner's hasher) calls the SHA extensions directly or inlines the scalar
+    * kernel.
+    */
+    template<typename Work>
+    decltype(auto) dispatch_transform(Work&& work) {
+#if defined(__x86_64__) || defined(__i386__)
+        if(shani_transform::accelerated())
+            return work(std::type_identity<shani_direct_transform>{});
+#endif
+        return work(std::type_identity<scalar_transform>{});
+    }
+
+    /*
+    * SHA-256 on the Intel SHA extensions (sha256rnds2, sha256msg1/2).
+    *
+    * Support is detected at runtime; on CPUs without the extension every compression
+    * falls back to the portable scalar kernel, so the same binary runs everywhere.
+    * The state lives in the object itself, copies are cheap snapshots.
+    */
+    class sha256_shani final : public sha256 {
+    public:
+        virtual void update(const unsigned char* data, std::size_t length) override;
+
+        virtual void transform(const unsigned char* data) override;
+
+        virtual const hash_t& finalize() override;
+
+        virtual const hash_t& hash() override;
+
+        virtual hash_t state() const override;
+
+        static bool accelerated() {
+            return shani_transform::accelerated();
+        }
+
+    private:
+        basic_sha256<shani_transform> m_impl;
+    };
+
+}
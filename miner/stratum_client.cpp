@@ -0,0 +1,346 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "stratum_client.h"
+#include "hex.h"
+
+#include <cerrno>
+#include <utility>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr std::size_t MaxLine = 1 << 20;
+    constexpr const char* UserAgent = "ezminer/0.1";
+
+    bool hex_u32(const json::value& value, std::uint32_t& out) {
+        unsigned char bytes[4];
+        if(!hex::decode(value.as_string(), bytes, sizeof(bytes)))
+            return false;
+        out = std::uint32_t(bytes[0]) << 24 | std::uint32_t(bytes[1]) << 16 | std::uint32_t(bytes[2]) << 8 | bytes[3];
+        return true;
+    }
+
+    std::string hex_u32(std::uint32_t value) {
+        const unsigned char bytes[4] = {
+            static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+            static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value)
+        };
+        return hex::encode(bytes, sizeof(bytes));
+    }
+
+    bool hex_bytes(const json::value& value, std::vector<unsigned char>& out) {
+        const auto& text = value.as_string();
+        out.resize(text.size() / 2);
+        return hex::decode(text, out.data(), out.size());
+    }
+
+    std::string error_text(const json::value& error) {
+        if(error.is_null())
+            return {};
+        // [code, message, traceback] by convention, anything else as a fallback
+        if(error[1].is_string())
+            return error[1].as_string();
+        if(error.is_string())
+            return error.as_string();
+        return "rejected";
+    }
+
+}
+
+stratum_client::stratum_client(options opts, job_handler on_job)
+        : m_options(std::move(opts))
+          , m_onJob(std::move(on_job)) {
+}
+
+stratum_client::~stratum_client() {
+    disconnect();
+}
+
+bool stratum_client::connect() {
+    disconnect();
+    if(!open_socket())
+        return false;
+
+    bool ok = false, subscribed = false, authorized = false;
+    // the handlers point at the locals above, so every way out below settles them first
+    auto fail = [&] {
+        close_socket();
+        abandon_requests();
+        return false;
+    };
+
+    // result: [subscriptions, extranonce1, extranonce2_size]
+    auto sent = request("mining.subscribe", "[" + json::quote(UserAgent) + "]",
+                        [&](const json::value& result, const json::value& error) {
+        subscribed = true;
+        std::vector<unsigned char> extranonce1;
+        if(!error.is_null() || !hex_bytes(result[1], extranonce1) || !result[2].is_number())
+            return;
+        std::lock_guard lock(m_lock);
+        m_extranonce1 = std::move(extranonce1);
+        m_extranonce2Size = static_cast<unsigned>(result[2].as_int());
+        ok = true;
+    });
+    if(!sent || !await(subscribed) || !ok)
+        return fail();
+
+    ok = false;
+    sent = request("mining.authorize", "[" + json::quote(m_options.user) + "," + json::quote(m_options.password) + "]",
+                   [&](const json::value& result, const json::value& error) {
+        authorized = true;
+        ok = error.is_null() && result.as_bool();
+    });
+    if(!sent || !await(authorized) || !ok)
+        return fail();
+
+    m_connected = true;
+    m_reader = std::thread([this] { reader(); });
+    return true;
+}
+
+void stratum_client::disconnect() {
+    {
+        std::lock_guard lock(m_writeLock);
+        if(m_socket >= 0)
+            ::shutdown(m_socket, SHUT_RDWR);
+    }
+    if(m_reader.joinable())
+        m_reader.join();
+    close_socket();
+    m_connected = false;
+    abandon_requests();
+}
+
+bool stratum_client::submit(const mining_job::share& share, submit_handler on_result) {
+    if(!m_connected)
+        return false;
+
+    unsigned extranonce2_size;
+    {
+        std::lock_guard lock(m_lock);
+        extranonce2_size = m_extranonce2Size;
+    }
+    // the same little-endian bytes mining_job::coinbase puts into the coinbase
+    std::vector<unsigned char> extranonce2(extranonce2_size);
+    for(unsigned i = 0; i < extranonce2_size && i < 8; ++i)
+        extranonce2[i] = static_cast<unsigned char>(share.extranonce2 >> (i * 8));
+
+    std::string params = "[" + json::quote(m_options.user)
+            + "," + json::quote(share.job_id)
+            + ",\"" + hex::encode(extranonce2.data(), extranonce2.size())
+            + "\",\"" + hex_u32(share.ntime)
+            + "\",\"" + hex_u32(share.nonce) + "\"]";
+    return request("mining.submit", params, [on_result = std::move(on_result)](const json::value& result, const json::value& error) {
+        if(on_result)
+            on_result(error.is_null() && result.as_bool(), error_text(error));
+    });
+}
+
+double stratum_client::difficulty() const {
+    std::lock_guard lock(m_lock);
+    return m_difficulty;
+}
+
+bool stratum_client::open_socket() {
+    addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if(::getaddrinfo(m_options.host.c_str(), m_options.port.c_str(), &hints, &addresses) != 0)
+        return false;
+
+    int fd = -1;
+    for(auto address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if(fd < 0)
+            continue;
+        if(::connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(addresses);
+    if(fd < 0)
+        return false;
+
+    // shares are single small lines: send them at once; keepalive notices a silently dead pool
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+
+    std::lock_guard lock(m_writeLock);
+    m_socket = fd;
+    m_buffer.clear();
+    return true;
+}
+
+void stratum_client::close_socket() {
+    std::lock_guard lock(m_writeLock);
+    if(m_socket >= 0)
+        ::close(m_socket);
+    m_socket = -1;
+}
+
+bool stratum_client::send_line(const std::string& line) {
+    std::lock_guard lock(m_writeLock);
+    if(m_socket < 0)
+        return false;
+    const std::string data = line + "\n";
+    for(std::size_t sent = 0; sent < data.size();) {
+        auto written = ::send(m_socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(written < 0 && errno == EINTR)
+            continue;
+        if(written <= 0)
+            return false;
+        sent += static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+bool stratum_client::read_line(std::string& line) {
+    for(;;) {
+        auto end = m_buffer.find('\n');
+        if(end != std::string::npos) {
+            line.assign(m_buffer, 0, end);
+            m_buffer.erase(0, end + 1);
+            if(!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return true;
+        }
+        if(m_buffer.size() > MaxLine)
+            return false;
+
+        char chunk[4096];
+        auto received = ::recv(m_socket, chunk, sizeof(chunk), 0);
+        if(received < 0 && errno == EINTR)
+            continue;
+        if(received <= 0)
+            return false;
+        m_buffer.append(chunk, static_cast<std::size_t>(received));
+    }
+}
+
+bool stratum_client::request(const std::string& method, const std::string& params, response_handler on_response) {
+    std::uint64_t id;
+    {
+        std::lock_guard lock(m_lock);
+        id = m_nextId++;
+        m_pending.emplace(id, std::move(on_response));
+    }
+    if(send_line("{\"id\":" + std::to_string(id) + ",\"method\":" + json::quote(method) + ",\"params\":" + params + "}"))
+        return true;
+
+    std::lock_guard lock(m_lock);
+    m_pending.erase(id);
+    return false;
+}
+
+bool stratum_client::await(const bool& done) {
+    std::string line;
+    while(!done) {
+        if(!read_line(line))
+            return false;
+        dispatch(line);
+    }
+    return true;
+}
+
+void stratum_client::dispatch(const std::string& line) {
+    auto message = json::parse(line);
+    if(!message || !message->is_object())
+        return;
+
+    const auto& method = (*message)["method"];
+    if(method.is_string()) {
+        notified(method.as_string(), (*message)["params"]);
+        return;
+    }
+
+    response_handler handler;
+    {
+        std::lock_guard lock(m_lock);
+        auto pending = m_pending.find(static_cast<std::uint64_t>((*message)["id"].as_int()));
+        if(pending == m_pending.end())
+            return;
+        handler = std::move(pending->second);
+        m_pending.erase(pending);
+    }
+    if(handler)
+        handler((*message)["result"], (*message)["error"]);
+}
+
+void stratum_client::notified(const std::string& method, const json::value& params) {
+    if(method == "mining.set_difficulty") {
+        if(params[0].as_number() > 0) {
+            std::lock_guard lock(m_lock);
+            m_difficulty = params[0].as_number();
+        }
+        return;
+    }
+
+    if(method == "mining.set_extranonce") {
+        std::vector<unsigned char> extranonce1;
+        if(!hex_bytes(params[0], extranonce1) || !params[1].is_number())
+            return;
+        std::lock_guard lock(m_lock);
+        m_extranonce1 = std::move(extranonce1);
+        m_extranonce2Size = static_cast<unsigned>(params[1].as_int());
+        return;
+    }
+
+    if(method != "mining.notify")
+        return;
+
+    // [job_id, prevhash, coinb1, coinb2, merkle_branch, version, nbits, ntime, clean_jobs]
+    mining_job job;
+    job.id = params[0].as_string();
+    mining_job::hash_t prev_hash;
+    if(!hex::decode(params[1].as_string(), prev_hash.data(), prev_hash.size())
+       || !hex_bytes(params[2], job.coinbase1) || !hex_bytes(params[3], job.coinbase2)
+       || !hex_u32(params[5], job.version) || !hex_u32(params[6], job.nbits) || !hex_u32(params[7], job.ntime))
+        return;
+    // the previous hash comes as 32-bit words with their bytes swapped against the header
+    for(unsigned i = 0; i < 32; ++i)
+        job.prev_hash[i] = prev_hash[i / 4 * 4 + 3 - i % 4];
+    for(const auto& branch : params[4].as_array()) {
+        auto& hash = job.merkle_branch.emplace_back();
+        if(!hex::decode(branch.as_string(), hash.data(), hash.size()))
+            return;
+    }
+    job.ntime_roll = m_options.ntime_roll;
+    {
+        std::lock_guard lock(m_lock);
+        job.extranonce1 = m_extranonce1;
+        job.extranonce2_size = m_extranonce2Size;
+        job.target = crypto::target256::from_difficulty(m_difficulty);
+    }
+    if(m_onJob)
+        m_onJob(job, params[8].as_bool());
+}
+
+void stratum_client::reader() {
+    std::string line;
+    while(read_line(line))
+        dispatch(line);
+    m_connected = false;
+    abandon_requests();
+}
+
+void stratum_client::abandon_requests() {
+    std::map<std::uint64_t, response_handler> pending;
+    {
+        std::lock_guard lock(m_lock);
+        pending.swap(m_pending);
+    }
+    const json::value error(std::string("disconnected"));
+    for(auto&& [id, handler] : pending)
+        if(handler)
+            handler(json::value(), error);
+}
@@ -0,0 +1,107 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json.h"
+#include "mining_job.h"
+
+/*
+ * Stratum v1 pool client over one persistent TCP connection.
+ *
+ * connect() opens the socket and runs the mining.subscribe / mining.authorize handshake.
+ * From then on a reader thread takes the pool's pushes as they arrive: mining.set_difficulty
+ * sets the share target of the following jobs, and every mining.notify becomes a mining_job
+ * (with the subscription's extranonce1 / extranonce2 size) handed straight to the job handler,
+ * typically forwarded to miner::preempt. submit() sends mining.submit without waiting; the
+ * pool's verdict goes to an optional handler.
+ *
+ * Handlers run on the reader thread and should return quickly.
+ */
+class stratum_client final {
+public:
+    struct options {
+        std::string host;
+        std::string port;
+        std::string user;
+        std::string password;
+        std::uint32_t ntime_roll = 0;   // seconds the pool lets shares move ntime forward
+    };
+
+    // clean: the pool dropped every earlier job (new block), their shares would be stale
+    using job_handler = std::function<void(const mining_job& job, bool clean)>;
+    using submit_handler = std::function<void(bool accepted, const std::string& error)>;
+
+    stratum_client(options opts, job_handler on_job);
+
+    ~stratum_client();
+
+    stratum_client(const stratum_client&) = delete;
+    stratum_client& operator=(const stratum_client&) = delete;
+
+    // connects, subscribes and authorizes; false on network errors or when the pool refuses
+    bool connect();
+
+    void disconnect();
+
+    bool connected() const {
+        return m_connected.load();
+    }
+
+    // false when not connected; on_result sees the pool's answer, or a failure on disconnect
+    bool submit(const mining_job::share& share, submit_handler on_result = {});
+
+    double difficulty() const;
+
+private:
+    using response_handler = std::function<void(const json::value& result, const json::value& error)>;
+
+    bool open_socket();
+
+    void close_socket();
+
+    bool send_line(const std::string& line);
+
+    bool read_line(std::string& line);
+
+    // sends a request; `on_response` runs when the reply with its id arrives
+    bool request(const std::string& method, const std::string& params, response_handler on_response);
+
+    // reads and dispatches lines until `done` is set, used before the reader thread runs
+    bool await(const bool& done);
+
+    void dispatch(const std::string& line);
+
+    void notified(const std::string& method, const json::value& params);
+
+    void reader();
+
+    // fails every request still waiting for a reply
+    void abandon_requests();
+
+    options m_options;
+    job_handler m_onJob;
+
+    int m_socket = -1;
+    std::string m_buffer;           // received bytes not yet split into lines
+    std::thread m_reader;
+    std::atomic_bool m_connected { false };
+    std::mutex m_writeLock;
+
+    mutable std::mutex m_lock;
+    std::map<std::uint64_t, response_handler> m_pending;
+    std::uint64_t m_nextId = 1;
+    std::vector<unsigned char> m_extranonce1;
+    unsigned m_extranonce2Size = 4;
+    double m_difficulty = 1.0;
+};
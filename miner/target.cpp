@@ -0,0 +1,68 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#include "target.h"
+
+#include <cmath>
+
+namespace crypto {
+
+    target256 target256::from_compact(std::uint32_t nbits) {
+        const unsigned exponent = nbits >> 24;
+        std::uint32_t mantissa = nbits & 0x007fffff;
+        if(mantissa == 0 || (nbits & 0x00800000))
+            return {};
+        // mantissa * 256^(exponent - 3)
+        hash_t bytes = {0};
+        if(exponent < 3) {
+            mantissa >>= 8 * (3 - exponent);
+            for(unsigned i = 0; i < 3; ++i)
+                bytes[i] = static_cast<unsigned char>(mantissa >> (i * 8));
+            return from_le(bytes);
+        }
+        for(unsigned i = 0; i < 3; ++i) {
+            const auto byte = static_cast<unsigned char>(mantissa >> (i * 8));
+            const unsigned position = exponent - 3 + i;
+            if(position >= bytes.size()) {
+                if(byte)
+                    return {};
+                continue;
+            }
+            bytes[position] = byte;
+        }
+        return from_le(bytes);
+    }
+
+    target256 target256::from_difficulty(double difficulty) {
+        if(!(difficulty > 0))
+            return max();
+        // 0xffff0000 / difficulty placed at 32-bit word `word`, scaled down a word at a time
+        int word = 6;
+        for(; word > 0 && difficulty > 1.0; --word)
+            difficulty /= 4294967296.0;
+        const double scaled = 4294901760.0 / difficulty;
+        if(scaled >= 18446744073709551616.0)
+            return max();
+        const auto mantissa = static_cast<std::uint64_t>(scaled);
+        hash_t bytes = {0};
+        for(unsigned i = 0; i < 8 && word * 4 + i < 32; ++i)
+            bytes[word * 4 + i] = static_cast<unsigned char>(mantissa >> (i * 8));
+        return from_le(bytes);
+    }
+
+    target256::hash_t target256::to_le() const {
+        hash_t bytes;
+        for(unsigned i = 0; i < 32; ++i)
+            bytes[i] = static_cast<unsigned char>(m_limbs[i / 8] >> (i % 8 * 8));
+        return bytes;
+    }
+
+    double target256::difficulty() const {
+        double value = 0;
+        for(unsigned i = 4; i-- > 0;)
+            value = value * 18446744073709551616.0 + static_cast<double>(m_limbs[i]);
+        return value > 0 ? std::ldexp(65535.0, 208) / value : HUGE_VAL;
+    }
+
+}
@@ -0,0 +1,92 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+namespace crypto {
+
+    /*
+     * 256-bit hash target held as four native 64-bit limbs, least significant first.
+     *
+     * Targets arrive as little-endian numbers (getwork, reversed getblocktemplate hex), compact
+     * nBits or pool difficulties and are converted once per job. Checking a hash then takes four
+     * word loads and a borrow chain, with no copies, byte swaps or per-byte branches.
+     */
+    class target256 {
+    public:
+        using hash_t = std::array<unsigned char, 32>;
+
+        // zero: only the all-zero hash meets it
+        constexpr target256() = default;
+
+        // from a little-endian number, the byte order of SHA-256 digests and getwork targets
+        static target256 from_le(const unsigned char* bytes) {
+            target256 result;
+            for(unsigned i = 0; i < 4; ++i)
+                result.m_limbs[i] = load_le64(bytes + i * 8);
+            return result;
+        }
+
+        static target256 from_le(const hash_t& bytes) {
+            return from_le(bytes.data());
+        }
+
+        // block target of a compact nBits, zero when it is negative or overflows 256 bits
+        static target256 from_compact(std::uint32_t nbits);
+
+        // share target of a pool difficulty, difficulty 1 being 0xffff * 2^208; every hash for difficulty <= 0
+        static target256 from_difficulty(double difficulty);
+
+        // every hash meets it
+        static target256 max() {
+            target256 result;
+            result.m_limbs.fill(~std::uint64_t { 0 });
+            return result;
+        }
+
+        hash_t to_le() const;
+
+        // whether `hash`, read as a little-endian number, is at most the target
+        bool met_by(const unsigned char* hash) const {
+            // borrow out of target - hash, computed from the least significant limb up
+            std::uint64_t borrow = 0;
+            for(unsigned i = 0; i < 4; ++i) {
+                const auto word = load_le64(hash + i * 8);
+                borrow = static_cast<std::uint64_t>(m_limbs[i] < word) | (static_cast<std::uint64_t>(m_limbs[i] == word) & borrow);
+            }
+            return borrow == 0;
+        }
+
+        bool met_by(const hash_t& hash) const {
+            return met_by(hash.data());
+        }
+
+        // bound for the probe stage: no hash whose top 32 bits exceed it meets the target
+        std::uint32_t top32() const {
+            return static_cast<std::uint32_t>(m_limbs[3] >> 32);
+        }
+
+        // difficulty 1 target over this one
+        double difficulty() const;
+
+        bool operator==(const target256&) const = default;
+
+    private:
+        static std::uint64_t load_le64(const unsigned char* p) {
+            std::uint64_t value;
+            std::memcpy(&value, p, sizeof(value));
+            if constexpr(std::endian::native == std::endian::big)
+                value = __builtin_bswap64(value);
+            return value;
+        }
+
+        std::array<std::uint64_t, 4> m_limbs {};
+    };
+
+}
@@ -0,0 +1,311 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+/*
+ * Solo mining against test::mock_node: getblocktemplate over rpc_transport, block_template::parse,
+ * a block found on the template serialized by block() and sent with submitblock. The node checks
+ * the block on its own (OpenSSL hashes, its own merkle tree), the way bitcoind's submitblock
+ * would reject it. Known answers for the BIP 34 height push, the coinbase merkle branch and the
+ * segwit coinbase serialization come first.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "block_template.h"
+#include "header_hasher.h"
+#include "hex.h"
+#include "rpc_transport.h"
+#include "sha256_openssl.h"
+
+#include "local_server.h"
+#include "mock_node.h"
+
+namespace {
+
+    using bytes = std::vector<unsigned char>;
+    using hash_t = mining_job::hash_t;
+
+    constexpr std::int64_t Height = 812345;
+    constexpr std::uint64_t CoinbaseValue = 625000000;
+    // 2^-8 of the hashes meet it
+    constexpr const char* Target = "00ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff";
+    constexpr const char* Commitment = "6a24aa21a9ed0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20";
+    constexpr const char* Payout = "76a914000102030405060708090a0b0c0d0e0f1011121388ac";
+
+    bytes from_hex(const std::string& text) {
+        bytes result(text.size() / 2);
+        hex::decode(text, result.data(), result.size());
+        return result;
+    }
+
+    hash_t sha256d(const unsigned char* data, std::size_t length) {
+        crypto::sha256_openssl first;
+        first.update(data, length);
+        auto hash = first.finalize();
+        crypto::sha256_openssl second;
+        second.update(hash.data(), hash.size());
+        return second.finalize();
+    }
+
+    hash_t sha256d(const bytes& data) {
+        return sha256d(data.data(), data.size());
+    }
+
+    // the whole tree, the last node of an odd level paired with itself
+    hash_t merkle_root(std::vector<hash_t> level) {
+        while(level.size() > 1) {
+            if(level.size() % 2)
+                level.push_back(level.back());
+            std::vector<hash_t> next;
+            for(std::size_t i = 0; i < level.size(); i += 2) {
+                bytes pair(level[i].begin(), level[i].end());
+                pair.insert(pair.end(), level[i + 1].begin(), level[i + 1].end());
+                next.push_back(sha256d(pair));
+            }
+            level = std::move(next);
+        }
+        return level.front();
+    }
+
+    // the root from the first leaf up its branch
+    hash_t branch_root(hash_t leaf, const std::vector<hash_t>& branch) {
+        for(const auto& sibling : branch) {
+            bytes pair(leaf.begin(), leaf.end());
+            pair.insert(pair.end(), sibling.begin(), sibling.end());
+            leaf = sha256d(pair);
+        }
+        return leaf;
+    }
+
+    hash_t leaf(unsigned index) {
+        hash_t hash;
+        for(unsigned i = 0; i < 32; ++i)
+            hash[i] = static_cast<unsigned char>(index * 37 + i);
+        return hash;
+    }
+
+    std::string display(hash_t hash) {
+        std::reverse(hash.begin(), hash.end());
+        return hex::encode(hash.data(), hash.size());
+    }
+
+    void height_push_known_answers() {
+        CHECK(block_template::height_push(0) == bytes({ 0x00 }));
+        for(std::int64_t height = 1; height <= 16; ++height)
+            CHECK(block_template::height_push(height) == bytes({ static_cast<unsigned char>(0x50 + height) }));
+        CHECK(block_template::height_push(17) == bytes({ 0x01, 0x11 }));
+        CHECK(block_template::height_push(127) == bytes({ 0x01, 0x7f }));
+        // a set top bit would read as negative: a zero byte keeps it positive
+        CHECK(block_template::height_push(128) == bytes({ 0x02, 0x80, 0x00 }));
+        CHECK(block_template::height_push(255) == bytes({ 0x02, 0xff, 0x00 }));
+        CHECK(block_template::height_push(256) == bytes({ 0x02, 0x00, 0x01 }));
+        CHECK(block_template::height_push(std::int64_t { 1 } << 23) == bytes({ 0x04, 0x00, 0x00, 0x80, 0x00 }));
+        CHECK(block_template::height_push(Height) == bytes({ 0x03, 0x39, 0x65, 0x0c }));
+    }
+
+    void coinbase_branch_known_answers() {
+        const auto pair = [](const hash_t& left, const hash_t& right) {
+            bytes data(left.begin(), left.end());
+            data.insert(data.end(), right.begin(), right.end());
+            return sha256d(data);
+        };
+        const auto a = leaf(1), b = leaf(2), c = leaf(3);
+
+        CHECK(block_template::coinbase_branch({}).empty());
+        // two transactions (coinbase, a): one level
+        CHECK(block_template::coinbase_branch({ a }) == std::vector<hash_t>({ a }));
+        // three (odd): b is paired with itself on the first level
+        CHECK(block_template::coinbase_branch({ a, b }) == std::vector<hash_t>({ a, pair(b, b) }));
+        // four (even)
+        CHECK(block_template::coinbase_branch({ a, b, c }) == std::vector<hash_t>({ a, pair(b, c) }));
+
+        // every count up to 17 leaves against the whole tree
+        const auto coinbase = leaf(100);
+        for(unsigned count = 0; count <= 16; ++count) {
+            std::vector<hash_t> others, leaves { coinbase };
+            for(unsigned i = 0; i < count; ++i) {
+                others.push_back(leaf(i));
+                leaves.push_back(leaf(i));
+            }
+            CHECK(branch_root(coinbase, block_template::coinbase_branch(others)) == merkle_root(leaves));
+        }
+    }
+
+    // what the node put into its template
+    struct expected_block {
+        hash_t prev_hash;
+        std::vector<bytes> transactions;
+    };
+
+    std::size_t read_varint(const bytes& data, std::size_t& at) {
+        auto first = data.at(at++);
+        if(first < 0xfd)
+            return first;
+        unsigned size = first == 0xfd ? 2 : first == 0xfe ? 4 : 8;
+        std::size_t value = 0;
+        for(unsigned i = 0; i < size; ++i)
+            value |= std::size_t { data.at(at++) } << (i * 8);
+        return value;
+    }
+
+    // bitcoind's checks on a submitted block, the rejection reason or std::nullopt when it is valid
+    std::optional<std::string> check_block(const expected_block& expected, const bytes& block) {
+        if(block.size() < 80)
+            return "bad-blk-length";
+        const bytes header(block.begin(), block.begin() + 80);
+        auto hash = sha256d(header);
+        // target 0x00ff.. : the top byte of the little-endian hash is zero
+        if(hash[31] != 0)
+            return "high-hash";
+        if(!std::equal(expected.prev_hash.begin(), expected.prev_hash.end(), header.begin() + 4))
+            return "bad-prevblk";
+
+        std::size_t at = 80;
+        if(read_varint(block, at) != expected.transactions.size() + 1)
+            return "bad-txns-count";
+
+        // segwit coinbase: version, marker 0x00, flag 0x01, inputs, outputs, witness, lock time
+        const std::size_t start = at;
+        if(block.at(at + 4) != 0x00 || block.at(at + 5) != 0x01)
+            return "bad-witness-marker";
+        at += 6;
+        if(read_varint(block, at) != 1)
+            return "bad-cb-inputs";
+        at += 36;
+        const auto script_size = read_varint(block, at);
+        const bytes script(block.begin() + at, block.begin() + at + script_size);
+        at += script_size + 4;
+        if(bytes(script.begin(), script.begin() + 4) != bytes({ 0x03, 0x39, 0x65, 0x0c }))
+            return "bad-cb-height";
+        const auto outputs = read_varint(block, at);
+        std::vector<std::pair<std::uint64_t, bytes>> paid;
+        for(std::size_t i = 0; i < outputs; ++i) {
+            std::uint64_t value = 0;
+            for(unsigned b = 0; b < 8; ++b)
+                value |= std::uint64_t { block.at(at++) } << (b * 8);
+            const auto size = read_varint(block, at);
+            paid.emplace_back(value, bytes(block.begin() + at, block.begin() + at + size));
+            at += size;
+        }
+        if(paid.size() != 2 || paid[0].first != CoinbaseValue || paid[0].second != from_hex(Payout)
+           || paid[1].first != 0 || paid[1].second != from_hex(Commitment))
+            return "bad-cb-outputs";
+        const std::size_t witness = at;
+        // one stack item: the 32-byte witness reserved value, all zero
+        if(read_varint(block, at) != 1 || read_varint(block, at) != 32
+           || !std::all_of(block.begin() + at, block.begin() + at + 32, [](unsigned char byte) { return byte == 0; }))
+            return "bad-witness-nonce-size";
+        at += 32;
+        bytes stripped(block.begin() + start, block.begin() + start + 4);
+        stripped.insert(stripped.end(), block.begin() + start + 6, block.begin() + witness);
+        stripped.insert(stripped.end(), block.begin() + at, block.begin() + at + 4);
+        at += 4;
+
+        std::vector<hash_t> txids { sha256d(stripped) };
+        for(const auto& tx : expected.transactions) {
+            if(!std::equal(tx.begin(), tx.end(), block.begin() + at))
+                return "bad-txns";
+            txids.push_back(sha256d(tx));
+            at += tx.size();
+        }
+        if(at != block.size())
+            return "bad-blk-length";
+        if(!std::equal(header.begin() + 36, header.begin() + 68, merkle_root(txids).begin()))
+            return "bad-txnmrklroot";
+        return std::nullopt;
+    }
+
+}
+
+int main() {
+    height_push_known_answers();
+    coinbase_branch_known_answers();
+
+    expected_block expected { leaf(7), {} };
+    std::string transactions;
+    for(unsigned i = 0; i < 5; ++i) {
+        bytes tx(60 + i);
+        for(std::size_t b = 0; b < tx.size(); ++b)
+            tx[b] = static_cast<unsigned char>(b * 13 + i);
+        const auto txid = sha256d(tx);
+        transactions += std::string(i ? "," : "") + "{\"data\":\"" + hex::encode(tx.data(), tx.size()) + "\",\"txid\":\"" + display(txid)
+                        + "\",\"hash\":\"" + display(txid) + "\"}";
+        expected.transactions.push_back(std::move(tx));
+    }
+    const auto gbt = "{\"version\":536870912,\"previousblockhash\":\"" + display(expected.prev_hash) + "\",\"bits\":\"1d00ffff\","
+                     "\"curtime\":1700000000,\"height\":" + std::to_string(Height) + ",\"coinbasevalue\":" + std::to_string(CoinbaseValue)
+                     + ",\"target\":\"" + Target + "\",\"longpollid\":\"lp1\",\"default_witness_commitment\":\"" + Commitment
+                     + "\",\"transactions\":[" + transactions + "]}";
+
+    test::mock_node node([&](const std::string& method, const json::value& params) -> std::string {
+        if(method == "getblocktemplate")
+            return gbt;
+        if(method == "submitblock") {
+            auto verdict = check_block(expected, from_hex(params[0].as_string()));
+            // null when accepted, otherwise the rejection reason
+            return verdict ? json::quote(*verdict) : "null";
+        }
+        return "null";
+    });
+
+    rpc_transport rpc(node.url(), "user:pass");
+    auto reply = rpc.call("getblocktemplate", "[{\"rules\":[\"segwit\"]}]");
+    CHECK(reply.result.has_value());
+    CHECK(node.authorization() == "Basic dXNlcjpwYXNz");
+    if(!reply.result)
+        return test::result();
+
+    block_template::options options;
+    options.payout_script = from_hex(Payout);
+    auto tmpl = block_template::parse(*reply.result, options);
+    CHECK(tmpl.has_value());
+    if(!tmpl)
+        return test::result();
+    CHECK(tmpl->height == Height && tmpl->coinbase_value == CoinbaseValue && tmpl->segwit);
+    CHECK(tmpl->job.id == "lp1" && tmpl->longpoll_id == "lp1");
+    CHECK(tmpl->job.prev_hash == expected.prev_hash);
+    CHECK(tmpl->job.nbits == 0x1d00ffff && tmpl->job.ntime == 1700000000 && tmpl->job.version == 0x20000000);
+    CHECK(tmpl->transactions.size() == 5);
+
+    // segwit serialization: marker and flag after the version, the reserved value before the lock time
+    const mining_job::share probe { tmpl->job.id, 0x0102030405060708, tmpl->job.ntime, 0 };
+    const auto coinbase = tmpl->job.coinbase(probe.extranonce2);
+    const auto serialized = from_hex(tmpl->block(probe));
+    const std::size_t start = 81;
+    CHECK(std::equal(coinbase.begin(), coinbase.begin() + 4, serialized.begin() + start));
+    CHECK(serialized[start + 4] == 0x00 && serialized[start + 5] == 0x01);
+    CHECK(std::equal(coinbase.begin() + 4, coinbase.end() - 4, serialized.begin() + start + 6));
+    const std::size_t witness = start + 6 + coinbase.size() - 8;
+    CHECK(serialized[witness] == 0x01 && serialized[witness + 1] == 0x20);
+    CHECK(std::all_of(serialized.begin() + witness + 2, serialized.begin() + witness + 34, [](unsigned char byte) { return byte == 0; }));
+    CHECK(std::equal(coinbase.end() - 4, coinbase.end(), serialized.begin() + witness + 34));
+    // the extranonce2 sits after the height push, little-endian
+    CHECK(std::equal(coinbase.begin() + 42 + 4, coinbase.begin() + 42 + 12, bytes({ 8, 7, 6, 5, 4, 3, 2, 1 }).begin()));
+    // the header commits to the witness-stripped coinbase
+    CHECK(tmpl->job.merkle_root(probe.extranonce2) == branch_root(sha256d(coinbase), tmpl->job.merkle_branch));
+
+    // a block on the template: the node accepts it, and rejects it with a wrong nonce
+    std::optional<mining_job::share> found;
+    const crypto::header_hasher<> hasher(tmpl->job.header(tmpl->job.merkle_root(3), tmpl->job.ntime));
+    for(std::uint32_t nonce = 0; nonce < (1u << 20) && !found; ++nonce)
+        if(tmpl->job.target.met_by(hasher.compute(nonce)))
+            found = mining_job::share { tmpl->job.id, 3, tmpl->job.ntime, nonce };
+    CHECK(found.has_value());
+    if(!found)
+        return test::result();
+
+    reply = rpc.call("submitblock", "[\"" + tmpl->block(*found) + "\"]");
+    CHECK(reply.result && reply.result->is_null());
+
+    auto missed = *found;
+    while(tmpl->job.target.met_by(hasher.compute(++missed.nonce)))
+        ;
+    reply = rpc.call("submitblock", "[\"" + tmpl->block(missed) + "\"]");
+    CHECK(reply.result && reply.result->is_string() && reply.result->as_string() == "high-hash");
+    return test::result();
+}
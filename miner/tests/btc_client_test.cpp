@@ -0,0 +1,233 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+/*
+ * The getwork bitcoin_client against test::mock_node: work is prefetched up to the configured
+ * depth and served without a round trip, shares queued while a submission is in flight go out
+ * as one JSON-RPC batch, a share submitted twice reaches the node once, and failing or
+ * unreachable nodes are retried with the jittered backoff.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "btc_client.h"
+#include "hex.h"
+
+#include "local_server.h"
+#include "mock_node.h"
+
+namespace {
+
+    using namespace std::chrono_literals;
+
+    constexpr std::size_t NonceOffset = 76;
+
+    // getwork data of work unit `index`, the previous block hash at bytes 4..35
+    std::string work_data(unsigned index) {
+        unsigned char data[128];
+        for(unsigned i = 0; i < sizeof(data); ++i)
+            data[i] = static_cast<unsigned char>(index * 31 + i);
+        return hex::encode(data, sizeof(data));
+    }
+
+    std::string work_result(unsigned index) {
+        return "{\"midstate\":\"" + std::string(64, '1') + "\",\"data\":\"" + work_data(index) + "\",\"hash1\":\""
+               + std::string(128, '0') + "\",\"target\":\"" + std::string(56, 'f') + "00000000\"}";
+    }
+
+    work with_nonce(work unit, unsigned char nonce) {
+        unit.data[NonceOffset] = nonce;
+        return unit;
+    }
+
+    // polls `done` for up to 5 seconds
+    template<typename Condition>
+    bool eventually(Condition&& done) {
+        for(auto deadline = std::chrono::steady_clock::now() + 5s; std::chrono::steady_clock::now() < deadline;
+            std::this_thread::sleep_for(5ms))
+            if(done())
+                return true;
+        return done();
+    }
+
+    // holds the node's answer to the first submission until release()
+    class gate {
+    public:
+        void pass() {
+            std::unique_lock lock(m_lock);
+            m_entered = true;
+            m_changed.notify_all();
+            m_changed.wait(lock, [this] { return m_released; });
+        }
+
+        bool entered() {
+            std::unique_lock lock(m_lock);
+            return m_changed.wait_for(lock, 5s, [this] { return m_entered; });
+        }
+
+        void release() {
+            std::lock_guard lock(m_lock);
+            m_released = true;
+            m_changed.notify_all();
+        }
+
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_changed;
+        bool m_entered = false;
+        bool m_released = false;
+    };
+
+    void backoff_bounds() {
+        for(int failures = 1; failures <= 20; ++failures) {
+            const auto ceiling = std::min<std::chrono::milliseconds>(30s, 250ms * (1 << std::min(failures - 1, 16)));
+            for(int i = 0; i < 50; ++i) {
+                const auto delay = bitcoin_client::backoff(failures);
+                CHECK(delay >= ceiling / 2 && delay <= ceiling);
+            }
+        }
+    }
+
+    void prefetch_ahead() {
+        constexpr auto FetchTime = 50ms;
+        std::mutex lock;
+        unsigned served = 0;
+
+        // the first reply has no result and the second is malformed, both are backed off from
+        test::mock_node node([&](const std::string& method, const json::value&) -> std::string {
+            std::this_thread::sleep_for(FetchTime);
+            std::lock_guard guard(lock);
+            const auto call = served++;
+            if(method != "getwork" || call == 0)
+                return "null";
+            if(call == 1)
+                return "{\"data\":\"zz\"}";
+            return work_result(call - 2);
+        });
+
+        bitcoin_client client(node.url(), "", 2);
+        const auto started = std::chrono::steady_clock::now();
+        work unit;
+        CHECK(client.get_work(&unit));
+        CHECK(std::chrono::steady_clock::now() - started >= 125ms + 250ms);
+        CHECK(hex::encode(unit.data, sizeof(unit.data)) == work_data(0));
+        CHECK(unit.share_target.top32() == 0);
+
+        // while the miner works on one unit the next two are fetched, and handed out in order
+        CHECK(eventually([&] { return client.stats().depth == 2; }));
+        const auto ready = std::chrono::steady_clock::now();
+        CHECK(client.get_work(&unit));
+        CHECK(std::chrono::steady_clock::now() - ready < FetchTime);
+        CHECK(hex::encode(unit.data, sizeof(unit.data)) == work_data(1));
+        CHECK(client.get_work(&unit));
+        CHECK(hex::encode(unit.data, sizeof(unit.data)) == work_data(2));
+
+        auto stats = client.stats();
+        CHECK(stats.failures == 2);
+        CHECK(stats.waited == 1 && stats.ready == 2);
+        CHECK(stats.idle_avoided >= 2 * FetchTime);
+        CHECK(stats.idle >= 125ms + 250ms);
+
+        // flushed work is never handed out, the queue fills up again with newer units
+        CHECK(eventually([&] { return client.stats().depth == 2; }));
+        client.flush();
+        CHECK(client.get_work(&unit));
+        CHECK(hex::encode(unit.data, sizeof(unit.data)) == work_data(5));
+        CHECK(client.stats().fetched >= 5);
+    }
+
+    void submit_batches_and_dedup() {
+        gate first;
+        std::mutex lock;
+        std::map<unsigned, unsigned> received;      // submitted nonce byte, times
+        bool gated = false;
+
+        test::mock_node node([&](const std::string& method, const json::value& params) -> std::string {
+            if(method != "getwork")
+                return "null";
+            if(!params[0].is_string())
+                return work_result(0);
+            unsigned char data[128];
+            if(!hex::decode(params[0].as_string(), data, sizeof(data)))
+                return "false";
+            bool hold;
+            {
+                std::lock_guard guard(lock);
+                ++received[data[NonceOffset]];
+                hold = !gated;
+                gated = true;
+            }
+            if(hold)
+                first.pass();
+            // the node turns down nonce 4
+            return data[NonceOffset] == 4 ? "false" : "true";
+        });
+
+        bitcoin_client client(node.url(), "user:password", 1);
+        work unit;
+        CHECK(client.get_work(&unit));
+        CHECK(hex::encode(unit.data, sizeof(unit.data)) == work_data(0));
+        CHECK(node.authorization() == "Basic dXNlcjpwYXNzd29yZA==");
+
+        // the first share is held by the node, the next ones queue up behind it
+        CHECK(client.submit(with_nonce(unit, 1)));
+        CHECK(first.entered());
+        CHECK(client.submit(with_nonce(unit, 2)));
+        CHECK(client.submit(with_nonce(unit, 3)));
+        CHECK(client.submit(with_nonce(unit, 4)));
+        CHECK(client.submit(with_nonce(unit, 2)));
+        first.release();
+
+        CHECK(eventually([&] {
+            auto done = client.submissions();
+            return done.accepted + done.rejected + done.duplicates == 5;
+        }));
+        const auto done = client.submissions();
+        CHECK(done.queued == 5 && done.overflow == 0);
+        CHECK(done.duplicates == 1);
+        CHECK(done.accepted == 3 && done.rejected == 1);
+        CHECK(done.batches == 2 && done.retries == 0);
+        CHECK(done.stale == 0 && done.abandoned == 0);
+        CHECK(done.max_latency >= done.last_latency && done.last_latency.count() > 0);
+
+        // one request for nonce 1, then 2, 3 and 4 together
+        const auto batches = node.batches();
+        CHECK(std::count(batches.begin(), batches.end(), 3) == 1);
+        std::lock_guard guard(lock);
+        CHECK(received == (std::map<unsigned, unsigned> { { 1, 1 }, { 2, 1 }, { 3, 1 }, { 4, 1 } }));
+    }
+
+    void submit_retries_while_unreachable() {
+        std::string port;
+        {
+            test::local_server closed;
+            port = closed.port();
+        }
+        bitcoin_client client("http://127.0.0.1:" + port + "/", "", 1);
+        work unit {};
+        const auto started = std::chrono::steady_clock::now();
+        CHECK(client.submit(unit));
+        // the second attempt waits out at least half of the first backoff step
+        CHECK(eventually([&] { return client.submissions().retries >= 2; }));
+        CHECK(std::chrono::steady_clock::now() - started >= 125ms);
+        const auto done = client.submissions();
+        CHECK(done.accepted == 0 && done.rejected == 0 && done.batches == 0 && done.abandoned == 0);
+    }
+
+}
+
+int main() {
+    backoff_bounds();
+    prefetch_ahead();
+    submit_batches_and_dedup();
+    submit_retries_while_unreachable();
+    return test::result();
+}
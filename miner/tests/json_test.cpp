@@ -0,0 +1,175 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+/*
+ * The allocation-free getwork reply path: json::scan_object and json::raw_string on getwork
+ * replies (members missing, out of order, nested or malformed), work_decode on top of them,
+ * and the rpc_buffer a connection reuses from one reply to the next. A replaced operator new
+ * counts what a warm decode allocates.
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+
+#include "btc_client.h"
+#include "hex.h"
+#include "json.h"
+#include "rpc_buffer.h"
+
+#include "local_server.h"
+
+namespace {
+
+    std::atomic<std::size_t> allocations { 0 };
+
+    constexpr std::string_view Keys[] = { "midstate", "data", "hash1", "target" };
+
+    const std::string Midstate = std::string(62, '1') + "2f";
+    const std::string Data = std::string(254, '0') + "80";
+    const std::string Hash1 = std::string(128, 'a');
+    const std::string Target = std::string(56, 'f') + "00000000";
+
+    std::string getwork_result() {
+        return "{\"midstate\": \"" + Midstate + "\", \"data\": \"" + Data + "\",\n \"hash1\": \"" + Hash1
+               + "\", \"target\": \"" + Target + "\"}";
+    }
+
+    void scan_getwork_reply() {
+        const auto reply = "{\"result\": " + getwork_result() + ", \"error\": null, \"id\": 0}";
+        constexpr std::string_view envelope[] = { "result", "error", "id" };
+        std::string_view outer[3];
+        CHECK(json::scan_object(reply, envelope, outer));
+        CHECK(outer[0] == getwork_result());
+        CHECK(outer[1] == "null" && outer[2] == "0");
+
+        std::string_view members[4];
+        CHECK(json::scan_object(outer[0], Keys, members));
+        CHECK(members[0] == "\"" + Midstate + "\"");
+        CHECK(members[1] == "\"" + Data + "\"");
+        CHECK(members[2] == "\"" + Hash1 + "\"");
+        CHECK(members[3] == "\"" + Target + "\"");
+        CHECK(json::raw_string(members[1]) == std::string_view(Data));
+
+        // members in any order, unrelated and nested members skipped without matching inside them
+        std::string_view reordered[4];
+        CHECK(json::scan_object("{\"target\":\"t\",\"extra\":{\"data\":\"inner\",\"list\":[1,\"x\",{}]},\"data\":\"d\"}",
+                                Keys, reordered));
+        CHECK(reordered[1] == "\"d\"" && reordered[3] == "\"t\"");
+        CHECK(reordered[0].empty() && reordered[2].empty());
+
+        // missing members are left empty, the scan itself succeeds
+        std::string_view missing[4];
+        CHECK(json::scan_object("{\"data\":\"00\"}", Keys, missing));
+        CHECK(missing[0].empty() && missing[1] == "\"00\"" && missing[2].empty() && missing[3].empty());
+        std::string_view empty[4];
+        CHECK(json::scan_object(" { } ", Keys, empty));
+        CHECK(empty[1].empty());
+
+        // anything but one well-formed object is refused
+        std::string_view ignored[4];
+        CHECK(!json::scan_object("", Keys, ignored));
+        CHECK(!json::scan_object("null", Keys, ignored));
+        CHECK(!json::scan_object("[{\"data\":\"00\"}]", Keys, ignored));
+        CHECK(!json::scan_object("{\"data\":\"00\"", Keys, ignored));
+        CHECK(!json::scan_object("{\"data\" \"00\"}", Keys, ignored));
+        CHECK(!json::scan_object("{\"data\":\"00\",}", Keys, ignored));
+        CHECK(!json::scan_object("{\"data\":\"00\"} x", Keys, ignored));
+        CHECK(!json::scan_object("{\"data\":\"0\n0\"}", Keys, ignored));
+        CHECK(!json::scan_object("{\"data\":[1,2}", Keys, ignored));
+        CHECK(!json::scan_object("{\"data\":tru}", Keys, ignored));
+        CHECK(!json::scan_object("{data:\"00\"}", Keys, ignored));
+
+        // raw_string only hands out literals that need no unescaping
+        CHECK(json::raw_string("\"abc\"") == std::string_view("abc"));
+        CHECK(json::raw_string("\"\"") == std::string_view());
+        CHECK(!json::raw_string("\"a\\\"b\""));
+        CHECK(!json::raw_string("12"));
+        CHECK(!json::raw_string("\""));
+    }
+
+    void decode_getwork_result() {
+        work unit {};
+        CHECK(work_decode(getwork_result(), &unit));
+        CHECK(unit.midstate[0] == 0x11 && unit.midstate[31] == 0x2f);
+        CHECK(unit.data[0] == 0 && unit.data[127] == 0x80);
+        CHECK(unit.hash1[63] == 0xaa);
+        CHECK(unit.share_target.top32() == 0);
+
+        auto without = [](const std::string& member) {
+            auto text = getwork_result();
+            auto at = text.find("\"" + member + "\"");
+            text.replace(at + 1, member.size(), "other");
+            return text;
+        };
+        CHECK(!work_decode(without("midstate"), &unit));
+        CHECK(!work_decode(without("target"), &unit));
+
+        auto replaced = [](const std::string& from, const std::string& to) {
+            auto text = getwork_result();
+            text.replace(text.find(from), from.size(), to);
+            return text;
+        };
+        // a digit short, not hex, not a string, escaped
+        CHECK(!work_decode(replaced(Midstate, Midstate.substr(1)), &unit));
+        CHECK(!work_decode(replaced(Hash1, "zz" + Hash1.substr(2)), &unit));
+        CHECK(!work_decode(replaced("\"" + Target + "\"", "12"), &unit));
+        CHECK(!work_decode(replaced(Data, "\\u0030" + Data.substr(1)), &unit));
+        CHECK(!work_decode(getwork_result() + "}", &unit));
+        CHECK(!work_decode("null", &unit));
+
+        // once warm, scanning and decoding a reply allocates nothing
+        const auto reply = getwork_result();
+        allocations = 0;
+        for(int i = 0; i < 1000; ++i)
+            CHECK(work_decode(reply, &unit));
+        CHECK(allocations == 0);
+    }
+
+    void reuse_reply_buffer() {
+        rpc_buffer reply;
+        reply.clear();
+        CHECK(reply.view().empty());
+
+        const std::string first(5000, 'x');
+        CHECK(reply.append(first.data(), first.size()));
+        CHECK(reply.view() == first && reply.buf[first.size()] == 0);
+        const auto capacity = reply.cap;
+        CHECK(capacity >= first.size() + 1);
+
+        // an empty reply reads as empty, not as what the previous one left behind
+        reply.clear();
+        CHECK(reply.view().empty() && reply.buf[0] == 0);
+        CHECK(std::string_view(reply.buf).empty());
+
+        CHECK(reply.append("{}", 2) && reply.append("\n", 1));
+        CHECK(reply.view() == "{}\n" && std::string_view(reply.buf) == "{}\n");
+        CHECK(reply.cap == capacity);
+    }
+
+}
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order::relaxed);
+    if(auto memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+int main() {
+    scan_getwork_reply();
+    decode_getwork_result();
+    reuse_reply_buffer();
+    return test::result();
+}
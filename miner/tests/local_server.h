@@ -0,0 +1,159 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Pieces shared by the protocol tests: a check that counts failures instead of aborting,
+ * and a loopback TCP listener on a port picked by the kernel, so tests never collide.
+ */
+namespace test {
+
+    inline int failures = 0;
+
+    inline void check(bool condition, const char* what, const char* file, int line) {
+        if(condition)
+            return;
+        ++failures;
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    }
+
+#define CHECK(condition) ::test::check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
+
+    // process exit code of a test executable
+    inline int result() {
+        if(failures)
+            std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return failures ? 1 : 0;
+    }
+
+    // one accepted client socket with line and length framed reads
+    class connection {
+    public:
+        explicit connection(int fd = -1) : m_socket(fd) {}
+
+        connection(connection&& rhs) noexcept : m_socket(rhs.m_socket), m_buffer(std::move(rhs.m_buffer)) {
+            rhs.m_socket = -1;
+        }
+
+        connection& operator=(connection&& rhs) noexcept {
+            std::swap(m_socket, rhs.m_socket);
+            std::swap(m_buffer, rhs.m_buffer);
+            return *this;
+        }
+
+        ~connection() {
+            if(m_socket >= 0)
+                ::close(m_socket);
+        }
+
+        bool valid() const {
+            return m_socket >= 0;
+        }
+
+        // unblocks a read on another thread
+        void shutdown() {
+            if(m_socket >= 0)
+                ::shutdown(m_socket, SHUT_RDWR);
+        }
+
+        // next line without its terminator ("\n" or "\r\n"), false once the peer closed
+        bool read_line(std::string& line) {
+            for(;;) {
+                auto end = m_buffer.find('\n');
+                if(end != std::string::npos) {
+                    line.assign(m_buffer, 0, end > 0 && m_buffer[end - 1] == '\r' ? end - 1 : end);
+                    m_buffer.erase(0, end + 1);
+                    return true;
+                }
+                if(!receive())
+                    return false;
+            }
+        }
+
+        bool read(std::size_t size, std::string& out) {
+            while(m_buffer.size() < size)
+                if(!receive())
+                    return false;
+            out.assign(m_buffer, 0, size);
+            m_buffer.erase(0, size);
+            return true;
+        }
+
+        bool write(std::string_view data) {
+            while(!data.empty()) {
+                auto sent = ::send(m_socket, data.data(), data.size(), MSG_NOSIGNAL);
+                if(sent <= 0)
+                    return false;
+                data.remove_prefix(static_cast<std::size_t>(sent));
+            }
+            return true;
+        }
+
+    private:
+        bool receive() {
+            char chunk[4096];
+            auto received = ::recv(m_socket, chunk, sizeof(chunk), 0);
+            if(received <= 0)
+                return false;
+            m_buffer.append(chunk, static_cast<std::size_t>(received));
+            return true;
+        }
+
+        int m_socket;
+        std::string m_buffer;
+    };
+
+    // listening socket on 127.0.0.1
+    class local_server {
+    public:
+        local_server() {
+            m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            if(m_socket < 0 || ::bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+               || ::listen(m_socket, 8) != 0 || ::getsockname(m_socket, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+                return;
+            m_port = std::to_string(ntohs(address.sin_port));
+        }
+
+        ~local_server() {
+            if(m_socket >= 0)
+                ::close(m_socket);
+        }
+
+        local_server(const local_server&) = delete;
+        local_server& operator=(const local_server&) = delete;
+
+        // empty when the listener could not be set up
+        const std::string& port() const {
+            return m_port;
+        }
+
+        // blocks for the next client, an invalid connection once shutdown() was called
+        connection accept() {
+            return connection(::accept(m_socket, nullptr, nullptr));
+        }
+
+        void shutdown() {
+            ::shutdown(m_socket, SHUT_RDWR);
+        }
+
+    private:
+        int m_socket = -1;
+        std::string m_port;
+    };
+
+}
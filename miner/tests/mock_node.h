@@ -0,0 +1,151 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "json.h"
+#include "local_server.h"
+
+namespace test {
+
+    /*
+    * bitcoind-style JSON-RPC node on loopback: HTTP/1.1 POSTs with keep-alive, one thread per
+    * connection (rpc_transport keeps several open).
+    *
+    * Every call goes to the test's handler, which returns the "result" as JSON text; a JSON-RPC
+    * batch (an array of calls) is answered by an array. The Authorization header of the last
+    * request and the number of calls in each request are kept for the test to check.
+    */
+    class mock_node {
+    public:
+        using handler = std::function<std::string(const std::string& method, const json::value& params)>;
+
+        explicit mock_node(handler on_call)
+                : m_onCall(std::move(on_call))
+                  , m_acceptor([this] { accept(); }) {
+        }
+
+        ~mock_node() {
+            m_server.shutdown();
+            m_acceptor.join();
+            {
+                std::lock_guard lock(m_lock);
+                for(auto&& client : m_clients)
+                    client->shutdown();
+            }
+            for(auto&& thread : m_threads)
+                thread.join();
+        }
+
+        mock_node(const mock_node&) = delete;
+        mock_node& operator=(const mock_node&) = delete;
+
+        std::string url() const {
+            return "http://127.0.0.1:" + m_server.port() + "/";
+        }
+
+        std::string authorization() const {
+            std::lock_guard lock(m_lock);
+            return m_authorization;
+        }
+
+        // calls per HTTP request so far, in arrival order
+        std::vector<std::size_t> batches() const {
+            std::lock_guard lock(m_lock);
+            return m_batches;
+        }
+
+    private:
+        void accept() {
+            for(;;) {
+                auto client = std::make_shared<connection>(m_server.accept());
+                if(!client->valid())
+                    return;
+                std::lock_guard lock(m_lock);
+                m_clients.push_back(client);
+                m_threads.emplace_back([this, client] { serve(*client); });
+            }
+        }
+
+        void serve(connection& client) {
+            std::string line, body;
+            for(;;) {
+                // request line and headers up to the blank line, then Content-Length bytes of body
+                if(!client.read_line(line))
+                    return;
+                std::size_t length = 0;
+                while(client.read_line(line) && !line.empty()) {
+                    auto colon = line.find(':');
+                    if(colon == std::string::npos)
+                        continue;
+                    auto name = line.substr(0, colon);
+                    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+                    auto value = line.substr(colon + 1);
+                    value.erase(0, value.find_first_not_of(' '));
+                    if(name == "content-length") {
+                        length = std::strtoul(value.c_str(), nullptr, 10);
+                    } else if(name == "authorization") {
+                        std::lock_guard lock(m_lock);
+                        m_authorization = value;
+                    }
+                }
+                if(!client.read(length, body))
+                    return;
+
+                auto request = json::parse(body);
+                std::string reply;
+                if(request && request->is_array()) {
+                    for(const auto& call : request->as_array())
+                        reply += (reply.empty() ? "[" : ",") + answer(&call);
+                    reply += reply.empty() ? "[]" : "]";
+                } else {
+                    reply = answer(request ? &*request : nullptr);
+                }
+                {
+                    std::lock_guard lock(m_lock);
+                    m_batches.push_back(request && request->is_array() ? request->as_array().size() : 1);
+                }
+                if(!client.write("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+                                 + std::to_string(reply.size()) + "\r\n\r\n" + reply))
+                    return;
+            }
+        }
+
+        // reply object to one call, nullptr when the request did not parse
+        std::string answer(const json::value* call) {
+            std::string id = "null", result = "null", error = "null";
+            if(!call || !(*call)["method"].is_string()) {
+                error = "{\"code\":-32700,\"message\":\"Parse error\"}";
+            } else {
+                if((*call)["id"].is_number())
+                    id = std::to_string((*call)["id"].as_int());
+                result = m_onCall((*call)["method"].as_string(), (*call)["params"]);
+            }
+            return "{\"result\":" + result + ",\"error\":" + error + ",\"id\":" + id + "}";
+        }
+
+        handler m_onCall;
+        local_server m_server;
+
+        mutable std::mutex m_lock;
+        std::string m_authorization;
+        std::vector<std::size_t> m_batches;
+        std::vector<std::shared_ptr<connection>> m_clients;
+        std::vector<std::thread> m_threads;
+
+        std::thread m_acceptor;     // last, so it starts with every other member constructed
+    };
+
+}
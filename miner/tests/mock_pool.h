@@ -0,0 +1,136 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "json.h"
+#include "local_server.h"
+
+namespace test {
+
+    /*
+    * Stratum v1 pool on loopback serving one client connection.
+    *
+    * Answers mining.subscribe with the configured extranonce1 and extranonce2 size and
+    * mining.authorize with true; mining.submit gets whatever the test's verdict says. Every
+    * request is recorded for the test to inspect, and notify() pushes set_difficulty, notify
+    * or set_extranonce to the client.
+    */
+    class mock_pool {
+    public:
+        // result and error of the reply to a mining.submit, both as JSON text
+        using verdict = std::function<std::pair<std::string, std::string>(const json::value& params)>;
+
+        mock_pool(std::string extranonce1, unsigned extranonce2_size, verdict on_submit)
+                : m_extranonce1(std::move(extranonce1))
+                  , m_extranonce2Size(extranonce2_size)
+                  , m_onSubmit(std::move(on_submit))
+                  , m_thread([this] { serve(); }) {
+        }
+
+        ~mock_pool() {
+            m_server.shutdown();
+            {
+                std::lock_guard lock(m_lock);
+                m_client.shutdown();
+            }
+            m_thread.join();
+        }
+
+        mock_pool(const mock_pool&) = delete;
+        mock_pool& operator=(const mock_pool&) = delete;
+
+        const std::string& port() const {
+            return m_server.port();
+        }
+
+        // sends a notification, false without a connected client
+        bool notify(const std::string& method, const std::string& params) {
+            return send("{\"id\":null,\"method\":" + json::quote(method) + ",\"params\":" + params + "}");
+        }
+
+        // the oldest recorded request with `method`, std::nullopt if none arrives in time
+        std::optional<json::value> request(const std::string& method, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+            std::unique_lock lock(m_lock);
+            std::optional<json::value> found;
+            m_received.wait_for(lock, timeout, [&] {
+                for(auto it = m_requests.begin(); it != m_requests.end(); ++it) {
+                    if((*it)["method"].is_string() && (*it)["method"].as_string() == method) {
+                        found = std::move(*it);
+                        m_requests.erase(it);
+                        return true;
+                    }
+                }
+                return false;
+            });
+            return found;
+        }
+
+    private:
+        bool send(const std::string& line) {
+            std::lock_guard lock(m_lock);
+            return m_client.valid() && m_client.write(line + "\n");
+        }
+
+        void reply(const json::value& id, const std::string& result, const std::string& error) {
+            const auto id_text = id.is_number() ? std::to_string(id.as_int()) : std::string("null");
+            send("{\"id\":" + id_text + ",\"result\":" + result + ",\"error\":" + error + "}");
+        }
+
+        void serve() {
+            auto client = m_server.accept();
+            if(!client.valid())
+                return;
+            {
+                std::lock_guard lock(m_lock);
+                m_client = std::move(client);
+            }
+
+            std::string line;
+            // reads need no lock: only this thread reads, writers only use the socket
+            while(m_client.read_line(line)) {
+                auto message = json::parse(line);
+                if(!message || !(*message)["method"].is_string())
+                    continue;
+                const auto& method = (*message)["method"].as_string();
+                const auto& id = (*message)["id"];
+                if(method == "mining.subscribe")
+                    reply(id, "[[[\"mining.notify\",\"1\"]]," + json::quote(m_extranonce1) + "," + std::to_string(m_extranonce2Size) + "]", "null");
+                else if(method == "mining.authorize")
+                    reply(id, "true", "null");
+                else if(method == "mining.submit") {
+                    auto [result, error] = m_onSubmit((*message)["params"]);
+                    reply(id, result, error);
+                }
+
+                std::lock_guard lock(m_lock);
+                m_requests.push_back(std::move(*message));
+                m_received.notify_all();
+            }
+        }
+
+        std::string m_extranonce1;
+        unsigned m_extranonce2Size;
+        verdict m_onSubmit;
+        local_server m_server;
+
+        std::mutex m_lock;
+        std::condition_variable m_received;
+        connection m_client;
+        std::deque<json::value> m_requests;
+
+        std::thread m_thread;   // last, so it starts with every other member constructed
+    };
+
+}
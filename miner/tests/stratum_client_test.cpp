@@ -0,0 +1,277 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+/*
+ * stratum_client against test::mock_pool: the subscribe / authorize handshake, how
+ * mining.notify, set_difficulty and set_extranonce turn into mining_jobs, and the encoding
+ * of mining.submit. The pool checks submitted shares on its own, rebuilding the header
+ * from the notification fields with OpenSSL, so a byte order slip on either side shows up
+ * as a rejected share.
+ */
+
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "header_hasher.h"
+#include "hex.h"
+#include "mining_job.h"
+#include "sha256_openssl.h"
+#include "stratum_client.h"
+
+#include "local_server.h"
+#include "mock_pool.h"
+
+namespace {
+
+    constexpr const char* User = "worker.1";
+    constexpr const char* Password = "x";
+    // 2^-16 of the hashes meet it, a share is found in well under a second
+    constexpr double Difficulty = 1.0 / 65536;
+    constexpr const char* DifficultyText = "0.0000152587890625";
+
+    // what the pool sent for a job, as hex text
+    struct pool_job {
+        std::string prev_hash;
+        std::string coinbase1;
+        std::string coinbase2;
+        std::vector<std::string> merkle_branch;
+        std::string version;
+        std::string nbits;
+        std::string ntime;
+        std::string extranonce1;
+    };
+
+    std::vector<unsigned char> bytes(const std::string& text) {
+        std::vector<unsigned char> result(text.size() / 2);
+        hex::decode(text, result.data(), result.size());
+        return result;
+    }
+
+    crypto::sha256::hash_t sha256d(const std::vector<unsigned char>& data) {
+        crypto::sha256_openssl first;
+        first.update(data.data(), data.size());
+        auto hash = first.finalize();
+        crypto::sha256_openssl second;
+        second.update(hash.data(), hash.size());
+        return second.finalize();
+    }
+
+    // 32-bit big-endian hex field as the little-endian bytes of the header
+    void append_u32(std::vector<unsigned char>& out, const std::string& text) {
+        auto value = bytes(text);
+        out.insert(out.end(), value.rbegin(), value.rend());
+    }
+
+    // the pool's own share check: header from the notification fields, hash at most the difficulty 1/65536 target
+    bool valid_share(const pool_job& job, const std::string& extranonce2, const std::string& ntime, const std::string& nonce) {
+        auto coinbase = bytes(job.coinbase1 + job.extranonce1 + extranonce2 + job.coinbase2);
+        auto root = sha256d(coinbase);
+        for(const auto& sibling : job.merkle_branch) {
+            std::vector<unsigned char> pair(root.begin(), root.end());
+            auto hash = bytes(sibling);
+            pair.insert(pair.end(), hash.begin(), hash.end());
+            root = sha256d(pair);
+        }
+
+        std::vector<unsigned char> header;
+        append_u32(header, job.version);
+        // the stratum prevhash swaps the bytes of every 32-bit word
+        auto prev_hash = bytes(job.prev_hash);
+        for(unsigned word = 0; word < 8; ++word)
+            for(unsigned i = 4; i-- > 0;)
+                header.push_back(prev_hash[word * 4 + i]);
+        header.insert(header.end(), root.begin(), root.end());
+        append_u32(header, ntime);
+        append_u32(header, job.nbits);
+        append_u32(header, nonce);
+
+        // target 0xffff << 224: the top 32 bits of the little-endian hash below 0xffff
+        auto hash = sha256d(header);
+        const std::uint32_t top = hash[28] | hash[29] << 8 | hash[30] << 16 | std::uint32_t(hash[31]) << 24;
+        return header.size() == 80 && top < 0xffff;
+    }
+
+    std::string notify_params(const std::string& id, const pool_job& job, bool clean) {
+        std::string branch;
+        for(const auto& hash : job.merkle_branch)
+            branch += (branch.empty() ? "\"" : ",\"") + hash + "\"";
+        return "[\"" + id + "\",\"" + job.prev_hash + "\",\"" + job.coinbase1 + "\",\"" + job.coinbase2 + "\",[" + branch + "],\""
+               + job.version + "\",\"" + job.nbits + "\",\"" + job.ntime + "\"," + (clean ? "true" : "false") + "]";
+    }
+
+    // first nonce meeting the job's share target with the given extranonce2 and the job's ntime
+    std::optional<std::uint32_t> find_share(const mining_job& job, std::uint64_t extranonce2) {
+        const crypto::header_hasher<> hasher(job.header(job.merkle_root(extranonce2), job.ntime));
+        for(std::uint32_t nonce = 0; nonce < (1u << 24); ++nonce)
+            if(job.target.met_by(hasher.compute(nonce)))
+                return nonce;
+        return std::nullopt;
+    }
+
+    // jobs handed over by the client's reader thread
+    class job_queue {
+    public:
+        void push(const mining_job& job, bool clean) {
+            std::lock_guard lock(m_lock);
+            m_jobs.emplace_back(job, clean);
+            m_changed.notify_all();
+        }
+
+        std::optional<std::pair<mining_job, bool>> pop() {
+            std::unique_lock lock(m_lock);
+            if(!m_changed.wait_for(lock, std::chrono::seconds(5), [&] { return !m_jobs.empty(); }))
+                return std::nullopt;
+            auto job = m_jobs.front();
+            m_jobs.erase(m_jobs.begin());
+            return job;
+        }
+
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_changed;
+        std::vector<std::pair<mining_job, bool>> m_jobs;
+    };
+
+    // the verdict of a submitted share, once the pool's reply arrived
+    class verdict {
+    public:
+        stratum_client::submit_handler handler() {
+            return [this](bool accepted, const std::string& error) {
+                std::lock_guard lock(m_lock);
+                m_result = std::make_pair(accepted, error);
+                m_changed.notify_all();
+            };
+        }
+
+        std::optional<std::pair<bool, std::string>> get() {
+            std::unique_lock lock(m_lock);
+            m_changed.wait_for(lock, std::chrono::seconds(5), [&] { return m_result.has_value(); });
+            return m_result;
+        }
+
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_changed;
+        std::optional<std::pair<bool, std::string>> m_result;
+    };
+
+}
+
+int main() {
+    std::map<std::string, pool_job> jobs;
+    jobs["j1"] = {
+        "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+        "01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff20",
+        "ffffffff0100f2052a010000001976a914000000000000000000000000000000000000000088ac00000000",
+        { "11111111111111111111111111111111111111111111111111111111111111aa",
+          "22222222222222222222222222222222222222222222222222222222222222bb" },
+        "20000000", "1d00ffff", "62a1b2c3", "f000000f"
+    };
+    jobs["j2"] = jobs["j1"];
+    jobs["j2"].ntime = "62a1b2d0";
+    jobs["j2"].extranonce1 = "a1b2c3";
+
+    // jobs is not changed once the pool runs
+    test::mock_pool pool("f000000f", 4, [&](const json::value& params) -> std::pair<std::string, std::string> {
+        auto job = jobs.find(params[1].as_string());
+        if(job != jobs.end() && valid_share(job->second, params[2].as_string(), params[3].as_string(), params[4].as_string()))
+            return { "true", "null" };
+        return { "false", "[23,\"low difficulty share\",null]" };
+    });
+    CHECK(!pool.port().empty());
+
+    job_queue received;
+    stratum_client client({ "127.0.0.1", pool.port(), User, Password, 0 },
+                          [&](const mining_job& job, bool clean) { received.push(job, clean); });
+    CHECK(client.connect());
+    CHECK(client.connected());
+
+    auto subscribe = pool.request("mining.subscribe");
+    CHECK(subscribe && (*subscribe)["params"][0].is_string());
+    auto authorize = pool.request("mining.authorize");
+    CHECK(authorize && (*authorize)["params"][0].as_string() == User && (*authorize)["params"][1].as_string() == Password);
+
+    // set_difficulty applies to the jobs notified after it
+    CHECK(pool.notify("mining.set_difficulty", std::string("[") + DifficultyText + "]"));
+    CHECK(pool.notify("mining.notify", notify_params("j1", jobs["j1"], true)));
+    auto first = received.pop();
+    CHECK(first.has_value());
+    if(!first)
+        return test::result();
+    const auto& job = first->first;
+    CHECK(first->second);
+    CHECK(job.id == "j1");
+    CHECK(client.difficulty() == Difficulty);
+    CHECK(job.target == crypto::target256::from_difficulty(Difficulty));
+    CHECK(job.version == 0x20000000 && job.nbits == 0x1d00ffff && job.ntime == 0x62a1b2c3);
+    // 00010203 04050607 .. becomes 03020100 07060504 .. in the header
+    for(unsigned i = 0; i < 32; ++i)
+        CHECK(job.prev_hash[i] == i / 4 * 4 + 3 - i % 4);
+    CHECK(job.extranonce1 == bytes("f000000f") && job.extranonce2_size == 4);
+    CHECK(job.coinbase1 == bytes(jobs["j1"].coinbase1) && job.coinbase2 == bytes(jobs["j1"].coinbase2));
+    CHECK(job.merkle_branch.size() == 2 && job.merkle_branch[1][31] == 0xbb);
+
+    // a share found on the job, submitted with extranonce2 0x0a0b0c: little-endian, extranonce2_size bytes
+    auto nonce = find_share(job, 0x0a0b0c);
+    CHECK(nonce.has_value());
+    verdict accepted;
+    CHECK(client.submit({ job.id, 0x0a0b0c, job.ntime, nonce.value_or(0) }, accepted.handler()));
+    auto submit = pool.request("mining.submit");
+    CHECK(submit.has_value());
+    if(submit) {
+        const auto& params = (*submit)["params"];
+        CHECK(params[0].as_string() == User);
+        CHECK(params[1].as_string() == "j1");
+        CHECK(params[2].as_string() == "0c0b0a00");
+        CHECK(params[3].as_string() == "62a1b2c3");
+        char expected[9];
+        std::snprintf(expected, sizeof(expected), "%08x", nonce.value_or(0));
+        CHECK(params[4].as_string() == expected);
+    }
+    auto result = accepted.get();
+    CHECK(result && result->first && result->second.empty());
+
+    // set_extranonce changes extranonce1 and the extranonce2 size of the following jobs
+    CHECK(pool.notify("mining.set_extranonce", "[\"a1b2c3\",3]"));
+    CHECK(pool.notify("mining.notify", notify_params("j2", jobs["j2"], false)));
+    auto second = received.pop();
+    CHECK(second.has_value());
+    if(!second)
+        return test::result();
+    const auto& rolled = second->first;
+    CHECK(!second->second);
+    CHECK(rolled.id == "j2" && rolled.ntime == 0x62a1b2d0);
+    CHECK(rolled.extranonce1 == bytes("a1b2c3") && rolled.extranonce2_size == 3);
+
+    nonce = find_share(rolled, 0x0a0b0c);
+    CHECK(nonce.has_value());
+    verdict accepted_rolled;
+    CHECK(client.submit({ rolled.id, 0x0a0b0c, rolled.ntime, nonce.value_or(0) }, accepted_rolled.handler()));
+    submit = pool.request("mining.submit");
+    CHECK(submit && (*submit)["params"][2].as_string() == "0c0b0a");
+    result = accepted_rolled.get();
+    CHECK(result && result->first);
+
+    // a share that does not meet the target comes back rejected with the pool's reason
+    std::uint32_t bad = 0;
+    {
+        const crypto::header_hasher<> hasher(rolled.header(rolled.merkle_root(1), rolled.ntime));
+        while(rolled.target.met_by(hasher.compute(bad)))
+            ++bad;
+    }
+    verdict rejected;
+    CHECK(client.submit({ rolled.id, 1, rolled.ntime, bad }, rejected.handler()));
+    result = rejected.get();
+    CHECK(result && !result->first && result->second == "low difficulty share");
+
+    client.disconnect();
+    CHECK(!client.connected());
+    CHECK(!client.submit({ rolled.id, 2, rolled.ntime, 0 }));
+    return test::result();
+}
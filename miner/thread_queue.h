@@ -0,0 +1,280 @@
+/*
+ *       Copyright (C) 2022 ElectronRock - All Rights Reserved
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+namespace thread_queue_detail {
+
+    constexpr std::size_t CacheLine = 64;
+
+    /*
+    * Single-producer single-consumer ring. Each side keeps a private copy of the other
+    * side's index and reloads it only when the ring looks full (or empty), so the hot path
+    * touches a shared line only when the other side has moved.
+    */
+    template<typename T>
+    class spsc_ring {
+    public:
+        using value_type = T;
+
+        explicit spsc_ring(std::size_t capacity)
+                : m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1)
+                  , m_slots(std::make_unique<T[]>(m_mask + 1)) {
+        }
+
+        std::size_t capacity() const {
+            return m_mask + 1;
+        }
+
+        bool try_push(T& value) {
+            const auto tail = m_tail.load(std::memory_order::relaxed);
+            if(tail - m_headCache > m_mask) {
+                m_headCache = m_head.load(std::memory_order::acquire);
+                if(tail - m_headCache > m_mask)
+                    return false;
+            }
+            m_slots[tail & m_mask] = std::move(value);
+            m_tail.store(tail + 1, std::memory_order::release);
+            return true;
+        }
+
+        std::optional<T> try_pop() {
+            const auto head = m_head.load(std::memory_order::relaxed);
+            if(head == m_tailCache) {
+                m_tailCache = m_tail.load(std::memory_order::acquire);
+                if(head == m_tailCache)
+                    return std::nullopt;
+            }
+            std::optional<T> value(std::move(m_slots[head & m_mask]));
+            m_head.store(head + 1, std::memory_order::release);
+            return value;
+        }
+
+    private:
+        const std::size_t m_mask;
+        const std::unique_ptr<T[]> m_slots;
+        // producer side
+        alignas(CacheLine) std::atomic<std::size_t> m_tail { 0 };
+        std::size_t m_headCache { 0 };
+        // consumer side
+        alignas(CacheLine) std::atomic<std::size_t> m_head { 0 };
+        std::size_t m_tailCache { 0 };
+    };
+
+    /*
+    * Multi-producer multi-consumer ring (D. Vyukov's bounded queue): every slot carries a
+    * sequence number telling whether it is free for the position a producer claimed or
+    * filled for the position a consumer claimed, so the only contended operations are the
+    * two CAS on the head and tail positions.
+    */
+    template<typename T>
+    class mpmc_ring {
+    public:
+        using value_type = T;
+
+        explicit mpmc_ring(std::size_t capacity)
+                : m_mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1)
+                  , m_slots(std::make_unique<slot[]>(m_mask + 1)) {
+            for(std::size_t i = 0; i <= m_mask; ++i)
+                m_slots[i].sequence.store(i, std::memory_order::relaxed);
+        }
+
+        std::size_t capacity() const {
+            return m_mask + 1;
+        }
+
+        bool try_push(T& value) {
+            auto position = m_tail.load(std::memory_order::relaxed);
+            for(;;) {
+                auto& cell = m_slots[position & m_mask];
+                const auto sequence = cell.sequence.load(std::memory_order::acquire);
+                const auto lag = static_cast<std::intptr_t>(sequence - position);
+                if(lag == 0) {
+                    if(m_tail.compare_exchange_weak(position, position + 1, std::memory_order::relaxed)) {
+                        cell.value = std::move(value);
+                        cell.sequence.store(position + 1, std::memory_order::release);
+                        return true;
+                    }
+                } else if(lag < 0) {
+                    return false;   // the slot still holds the value of one lap ago: full
+                } else {
+                    position = m_tail.load(std::memory_order::relaxed);
+                }
+            }
+        }
+
+        std::optional<T> try_pop() {
+            auto position = m_head.load(std::memory_order::relaxed);
+            for(;;) {
+                auto& cell = m_slots[position & m_mask];
+                const auto sequence = cell.sequence.load(std::memory_order::acquire);
+                const auto lag = static_cast<std::intptr_t>(sequence - (position + 1));
+                if(lag == 0) {
+                    if(m_head.compare_exchange_weak(position, position + 1, std::memory_order::relaxed)) {
+                        std::optional<T> value(std::move(cell.value));
+                        cell.sequence.store(position + m_mask + 1, std::memory_order::release);
+                        return value;
+                    }
+                } else if(lag < 0) {
+                    return std::nullopt;
+                } else {
+                    position = m_head.load(std::memory_order::relaxed);
+                }
+            }
+        }
+
+    private:
+        // a line per slot: producers and consumers of neighbouring slots never share one
+        struct alignas(CacheLine) slot {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        const std::size_t m_mask;
+        const std::unique_ptr<slot[]> m_slots;
+        alignas(CacheLine) std::atomic<std::size_t> m_tail { 0 };
+        alignas(CacheLine) std::atomic<std::size_t> m_head { 0 };
+    };
+
+    /*
+    * Blocking front of a ring, with the semantics of the old mutex-based thread_q:
+    * push never blocks and fails while the queue is frozen (or here also when it is full),
+    * pop waits for a value, the deadline, or a freeze()/thaw(), which wake every waiter.
+    *
+    * Push and pop stay lock-free while nobody waits: a consumer spins briefly on an empty
+    * ring, then registers as a waiter and sleeps on a condition variable, and only then
+    * do producers take the mutex to wake it.
+    */
+    template<typename Ring>
+    class blocking_queue {
+    public:
+        using value_type = typename Ring::value_type;
+        using clock = std::chrono::steady_clock;
+
+        // the capacity is rounded up to a power of two
+        explicit blocking_queue(std::size_t capacity)
+                : m_ring(capacity) {
+        }
+
+        blocking_queue(const blocking_queue&) = delete;
+        blocking_queue& operator=(const blocking_queue&) = delete;
+
+        std::size_t capacity() const {
+            return m_ring.capacity();
+        }
+
+        // false when frozen or full
+        bool push(value_type value) {
+            if(m_frozen.load(std::memory_order::relaxed) || !m_ring.try_push(value))
+                return false;
+            // orders the published slot before the waiter check, paired with the fence in wait()
+            std::atomic_thread_fence(std::memory_order::seq_cst);
+            if(m_waiters.load(std::memory_order::relaxed) != 0) {
+                { std::lock_guard lock(m_lock); }
+                m_wake.notify_one();
+            }
+            return true;
+        }
+
+        std::optional<value_type> try_pop() {
+            return m_ring.try_pop();
+        }
+
+        // waits until a value arrives or the queue is frozen or thawed
+        std::optional<value_type> pop() {
+            return wait(std::nullopt);
+        }
+
+        // as pop(), std::nullopt also once `deadline` has passed
+        std::optional<value_type> pop_until(clock::time_point deadline) {
+            return wait(deadline);
+        }
+
+        template<typename Rep, typename Period>
+        std::optional<value_type> pop_for(std::chrono::duration<Rep, Period> timeout) {
+            return wait(clock::now() + std::chrono::duration_cast<clock::duration>(timeout));
+        }
+
+        // rejects pushes from now on and wakes the waiting consumers, queued values stay poppable
+        void freeze() {
+            set_frozen(true);
+        }
+
+        void thaw() {
+            set_frozen(false);
+        }
+
+        bool frozen() const {
+            return m_frozen.load(std::memory_order::relaxed);
+        }
+
+    private:
+        constexpr static unsigned SpinCount = 64;
+
+        std::optional<value_type> wait(std::optional<clock::time_point> deadline) {
+            for(unsigned spin = 0; spin < SpinCount; ++spin) {
+                if(auto value = m_ring.try_pop())
+                    return value;
+                std::this_thread::yield();
+            }
+
+            std::unique_lock lock(m_lock);
+            m_waiters.fetch_add(1, std::memory_order::relaxed);
+            std::atomic_thread_fence(std::memory_order::seq_cst);
+            const auto generation = m_generation;
+            std::optional<value_type> value;
+            while(!(value = m_ring.try_pop()) && m_generation == generation) {
+                if(!deadline) {
+                    m_wake.wait(lock);
+                } else if(m_wake.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                    value = m_ring.try_pop();
+                    break;
+                }
+            }
+            m_waiters.fetch_sub(1, std::memory_order::relaxed);
+            return value;
+        }
+
+        void set_frozen(bool frozen) {
+            {
+                std::lock_guard lock(m_lock);
+                m_frozen.store(frozen, std::memory_order::relaxed);
+                ++m_generation;
+            }
+            m_wake.notify_all();
+        }
+
+        Ring m_ring;
+        alignas(CacheLine) std::atomic<unsigned> m_waiters { 0 };
+        std::atomic_bool m_frozen { false };
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        std::uint64_t m_generation { 0 };   // under m_lock, bumped by freeze() and thaw()
+    };
+
+}
+
+/*
+ * Bounded lock-free queues for passing work and events between threads, slots preallocated
+ * at construction. spsc_queue: exactly one pushing and one popping thread; mpmc_queue: any.
+ */
+template<std::movable T> requires std::default_initializable<T>
+using spsc_queue = thread_queue_detail::blocking_queue<thread_queue_detail::spsc_ring<T>>;
+
+template<std::movable T> requires std::default_initializable<T>
+using mpmc_queue = thread_queue_detail::blocking_queue<thread_queue_detail::mpmc_ring<T>>;
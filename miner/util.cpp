@@ -19,8 +19,17 @@
 #include <jansson.h>
 #include <curl/curl.h>
 #include <time.h>
+#include <new>
 #include "miner.h"
 #include "elist.h"
+#include "hex.h"
+#include "json.h"
+#include "logger.h"
+#include "rpc_buffer.h"
+#include "target.h"
+#include "thread_queue.h"
+
+#define TQ_CAPACITY 256
 
 #if JANSSON_MAJOR_VERSION >= 2
 #define JSON_LOADS(str, err_ptr) json_loads((str), 0, (err_ptr))
@@ -28,11 +37,6 @@
 #define JSON_LOADS(str, err_ptr) json_loads((str), (err_ptr))
 #endif
 
-struct data_buffer {
-	void		*buf;
-	size_t		len;
-};
-
 struct upload_buffer {
 	const void	*buf;
 	size_t		len;
@@ -42,20 +46,15 @@ struct header_info {
 	char		*lp_path;
 };
 
-struct tq_ent {
-	void			*data;
-	struct list_head	q_node;
-};
-
+/* lock-free, slots preallocated: pushing never allocates, popping never frees */
 struct thread_q {
-	struct list_head	q;
-
-	bool frozen;
-
-	pthread_mutex_t		mutex;
-	pthread_cond_t		cond;
+	mpmc_queue<void *>	q { TQ_CAPACITY };
 };
 
+/*
+ * Queued for the logger thread (logger.h), which stamps and writes it:
+ * no lock, localtime or stderr write on the calling thread.
+ */
 void applog(int prio, const char *fmt, ...)
 {
 	va_list ap;
@@ -69,66 +68,34 @@ void applog(int prio, const char *fmt, ...)
 #else
 	if (0) {}
 #endif
-	else {
-		char *f;
-		int len;
-		struct timeval tv = { };
-		struct tm tm, *tm_p;
-
-		gettimeofday(&tv, NULL);
-
-		pthread_mutex_lock(&time_lock);
-		tm_p = localtime(&tv.tv_sec);
-		memcpy(&tm, tm_p, sizeof(tm));
-		pthread_mutex_unlock(&time_lock);
-
-		len = 40 + strlen(fmt) + 2;
-		f = alloca(len);
-		sprintf(f, "[%d-%02d-%02d %02d:%02d:%02d] %s\n",
-			tm.tm_year + 1900,
-			tm.tm_mon + 1,
-			tm.tm_mday,
-			tm.tm_hour,
-			tm.tm_min,
-			tm.tm_sec,
-			fmt);
-		vfprintf(stderr, f, ap);	/* atomic write to stderr */
-	}
+	else
+		logging::vwrite(prio, fmt, ap);
 	va_end(ap);
 }
 
-static void databuf_free(struct data_buffer *db)
+/*
+ * applog for the RPC and share paths: the arguments are queued as a binary record and
+ * formatted on the logger thread. Arguments must be printf-compatible (no string_view).
+ */
+template<typename... Args>
+static void applog_async(int prio, const char *fmt, const Args&... args)
 {
-	if (!db)
+#ifdef HAVE_SYSLOG_H
+	if (use_syslog) {
+		syslog(prio, fmt, args...);
 		return;
-
-	free(db->buf);
-
-	memset(db, 0, sizeof(*db));
+	}
+#endif
+	logging::write(prio, fmt, args...);
 }
 
 static size_t all_data_cb(const void *ptr, size_t size, size_t nmemb,
 			  void *user_data)
 {
-	struct data_buffer *db = user_data;
+	struct rpc_buffer *db = (struct rpc_buffer *) user_data;
 	size_t len = size * nmemb;
-	size_t oldlen, newlen;
-	void *newmem;
-	static const unsigned char zero;
-
-	oldlen = db->len;
-	newlen = oldlen + len;
 
-	newmem = realloc(db->buf, newlen + 1);
-	if (!newmem)
-		return 0;
-
-	db->buf = newmem;
-	db->len = newlen;
-	memcpy(db->buf + oldlen, ptr, len);
-	memcpy(db->buf + newlen, &zero, 1);	/* null terminate */
-
-	return len;
+	return db->append(ptr, len) ? len : 0;
 }
 
 static size_t upload_data_cb(void *ptr, size_t size, size_t nmemb,
@@ -186,7 +153,7 @@ static size_t resp_hdr_cb(void *ptr, size_t size, size_t nmemb, void *user_data)
 		goto out;
 
 	if (opt_protocol)
-		applog(LOG_DEBUG, "HTTP hdr(%s): %s", key, val);
+		applog_async(LOG_DEBUG, "HTTP hdr(%s): %s", key, val);
 
 	if (!strcasecmp("X-Long-Polling", key)) {
 		hi->lp_path = val;	/* steal memory reference */
@@ -199,17 +166,31 @@ out:
 	return ptrlen;
 }
 
-json_t *json_rpc_call(CURL *curl, const char *url,
-		      const char *userpass, const char *rpc_req,
-		      bool longpoll_scan, bool longpoll)
+/* constant request headers, built once: the length goes out through CURLOPT_POSTFIELDSIZE */
+static struct curl_slist *rpc_headers(void)
+{
+	static struct curl_slist *headers = [] {
+		char user_agent_hdr[128];
+		struct curl_slist *list = NULL;
+
+		snprintf(user_agent_hdr, sizeof(user_agent_hdr), "User-Agent: %s", PACKAGE_STRING);
+		list = curl_slist_append(list, "Content-type: application/json");
+		list = curl_slist_append(list, user_agent_hdr);
+		list = curl_slist_append(list, "Expect:"); /* disable Expect hdr*/
+		return list;
+	}();
+
+	return headers;
+}
+
+/* the HTTP exchange of a JSON-RPC call, the reply body lands in 'reply' */
+static bool rpc_exchange(CURL *curl, const char *url,
+			 const char *userpass, const char *rpc_req,
+			 bool longpoll_scan, bool longpoll,
+			 struct rpc_buffer *reply)
 {
-	json_t *val, *err_val, *res_val;
 	int rc;
-	struct data_buffer all_data = { };
 	struct upload_buffer upload_data;
-	json_error_t err = { };
-	struct curl_slist *headers = NULL;
-	char len_hdr[64], user_agent_hdr[128];
 	char curl_err_str[CURL_ERROR_SIZE];
 	long timeout = longpoll ? (60 * 60) : (60 * 10);
 	struct header_info hi = { };
@@ -220,6 +201,8 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 	if (longpoll_scan)
 		lp_scanning = want_longpoll && !have_longpoll;
 
+	reply->clear();
+
 	if (opt_protocol)
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	curl_easy_setopt(curl, CURLOPT_URL, url);
@@ -227,7 +210,7 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
 	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, all_data_cb);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &all_data);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, reply);
 	curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_data_cb);
 	curl_easy_setopt(curl, CURLOPT_READDATA, &upload_data);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_err_str);
@@ -244,47 +227,52 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 	curl_easy_setopt(curl, CURLOPT_POST, 1);
 
 	if (opt_protocol)
-		applog(LOG_DEBUG, "JSON protocol request:\n%s\n", rpc_req);
+		applog_async(LOG_DEBUG, "JSON protocol request:\n%s\n", rpc_req);
 
 	upload_data.buf = rpc_req;
 	upload_data.len = strlen(rpc_req);
-	sprintf(len_hdr, "Content-Length: %lu",
-		(unsigned long) upload_data.len);
-	sprintf(user_agent_hdr, "User-Agent: %s", PACKAGE_STRING);
-
-	headers = curl_slist_append(headers,
-		"Content-type: application/json");
-	headers = curl_slist_append(headers, len_hdr);
-	headers = curl_slist_append(headers, user_agent_hdr);
-	headers = curl_slist_append(headers, "Expect:"); /* disable Expect hdr*/
-
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) upload_data.len);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, rpc_headers());
 
 	rc = curl_easy_perform(curl);
+	curl_easy_reset(curl);
 	if (rc) {
-		applog(LOG_ERR, "HTTP request failed: %s", curl_err_str);
-		goto err_out;
+		applog_async(LOG_ERR, "HTTP request failed: %s", curl_err_str);
+		free(hi.lp_path);
+		return false;
 	}
 
-	/* If X-Long-Polling was found, activate long polling */
+	/* If X-Long-Polling was found, activate long polling; when the
+	 * bounded queue refuses the path, a later request scans again */
 	if (hi.lp_path) {
-		have_longpoll = true;
-		opt_scantime = 60;
-		tq_push(thr_info[longpoll_thr_id].q, hi.lp_path);
-	} else
-		free(hi.lp_path);
-	hi.lp_path = NULL;
+		if (tq_push(thr_info[longpoll_thr_id].q, hi.lp_path)) {
+			have_longpoll = true;
+			opt_scantime = 60;
+		} else
+			free(hi.lp_path);
+	}
+
+	if (opt_protocol)
+		applog_async(LOG_DEBUG, "JSON protocol response:\n%s", reply->buf);
+
+	return true;
+}
+
+json_t *json_rpc_call(CURL *curl, const char *url,
+		      const char *userpass, const char *rpc_req,
+		      bool longpoll_scan, bool longpoll)
+{
+	json_t *val, *err_val, *res_val;
+	struct rpc_buffer all_data;
+	json_error_t err = { };
+
+	if (!rpc_exchange(curl, url, userpass, rpc_req, longpoll_scan, longpoll, &all_data))
+		return NULL;
 
 	val = JSON_LOADS(all_data.buf, &err);
 	if (!val) {
-		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
-		goto err_out;
-	}
-
-	if (opt_protocol) {
-		char *s = json_dumps(val, JSON_INDENT(3));
-		applog(LOG_DEBUG, "JSON protocol response:\n%s", s);
-		free(s);
+		applog_async(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
+		return NULL;
 	}
 
 	/* JSON-RPC valid response returns a non-null 'result',
@@ -302,66 +290,80 @@ json_t *json_rpc_call(CURL *curl, const char *url,
 		else
 			s = strdup("(unknown reason)");
 
-		applog(LOG_ERR, "JSON-RPC call failed: %s", s);
+		applog_async(LOG_ERR, "JSON-RPC call failed: %s", s);
 
 		free(s);
+		json_decref(val);
 
-		goto err_out;
+		return NULL;
 	}
 
-	databuf_free(&all_data);
-	curl_slist_free_all(headers);
-	curl_easy_reset(curl);
 	return val;
+}
 
-err_out:
-	databuf_free(&all_data);
-	curl_slist_free_all(headers);
-	curl_easy_reset(curl);
-	return NULL;
+/* the reply body is left in 'reply' for callers that read it themselves (e.g. batch replies) */
+bool json_rpc_exchange(CURL *curl, const char *url,
+		       const char *userpass, const char *rpc_req,
+		       struct rpc_buffer *reply)
+{
+	return rpc_exchange(curl, url, userpass, rpc_req, false, false, reply);
+}
+
+/*
+ * json_rpc_call for hot paths: the reply stays in the connection's 'reply' buffer and the
+ * raw text of its "result" is returned, empty on failure. No DOM is built and, once the
+ * buffer has grown to the reply size, nothing is allocated.
+ */
+std::string_view json_rpc_call_raw(CURL *curl, const char *url,
+				   const char *userpass, const char *rpc_req,
+				   bool longpoll_scan, bool longpoll,
+				   struct rpc_buffer *reply)
+{
+	static constexpr std::string_view keys[] = { "result", "error" };
+	std::string_view values[2];
+
+	if (!rpc_exchange(curl, url, userpass, rpc_req, longpoll_scan, longpoll, reply))
+		return {};
+
+	if (!json::scan_object(reply->view(), keys, values)) {
+		applog_async(LOG_ERR, "JSON decode failed");
+		return {};
+	}
+
+	/* JSON-RPC valid response returns a non-null 'result',
+	 * and a null 'error'.
+	 */
+	if (values[0].empty() || values[0] == "null" ||
+	    (!values[1].empty() && values[1] != "null")) {
+		std::string_view reason = values[1].empty() ? "(unknown reason)" : values[1];
+
+		applog_async(LOG_ERR, "JSON-RPC call failed: %s", std::string(reason).c_str());
+		return {};
+	}
+
+	return values[0];
 }
 
 char *bin2hex(const unsigned char *p, size_t len)
 {
-	int i;
-	char *s = malloc((len * 2) + 1);
+	char *s = (char *) malloc((len * 2) + 1);
 	if (!s)
 		return NULL;
 
-	for (i = 0; i < len; i++)
-		sprintf(s + (i * 2), "%02x", (unsigned int) p[i]);
+	hex::encode_to(p, len, s);
+	s[len * 2] = 0;
 
 	return s;
 }
 
 bool hex2bin(unsigned char *p, const char *hexstr, size_t len)
 {
-	while (*hexstr && len) {
-		char hex_byte[3];
-		unsigned int v;
-
-		if (!hexstr[1]) {
-			applog(LOG_ERR, "hex2bin str truncated");
-			return false;
-		}
-
-		hex_byte[0] = hexstr[0];
-		hex_byte[1] = hexstr[1];
-		hex_byte[2] = 0;
-
-		if (sscanf(hex_byte, "%x", &v) != 1) {
-			applog(LOG_ERR, "hex2bin sscanf '%s' failed", hex_byte);
-			return false;
-		}
-
-		*p = (unsigned char) v;
-
-		p++;
-		hexstr += 2;
-		len--;
+	if (!hex::decode(hexstr, p, len)) {
+		applog_async(LOG_ERR, "hex2bin: expected %zu hex bytes", len);
+		return false;
 	}
 
-	return (len == 0 && *hexstr == 0) ? true : false;
+	return true;
 }
 
 /* Subtract the `struct timeval' values X and Y,
@@ -393,161 +395,82 @@ timeval_subtract (
   return x->tv_sec < y->tv_sec;
 }
 
-bool fulltest(const unsigned char *hash, const unsigned char *target)
+/* 'target' as converted once per work unit (work::share_target): no copies or byte swaps per hash */
+bool fulltest(const unsigned char *hash, const crypto::target256 &target)
 {
-	unsigned char hash_swap[32], target_swap[32];
-	uint32_t *hash32 = (uint32_t *) hash_swap;
-	uint32_t *target32 = (uint32_t *) target_swap;
-	int i;
-	bool rc = true;
-	char *hash_str, *target_str;
-
-	swap256(hash_swap, hash);
-	swap256(target_swap, target);
-
-	for (i = 0; i < 32/4; i++) {
-		uint32_t h32tmp = swab32(hash32[i]);
-		uint32_t t32tmp = target32[i];
-
-		target32[i] = swab32(target32[i]);	/* for printing */
-
-		if (h32tmp > t32tmp) {
-			rc = false;
-			break;
-		}
-		if (h32tmp < t32tmp) {
-			rc = true;
-			break;
-		}
-	}
+	bool rc = target.met_by(hash);
 
 	if (opt_debug) {
-		hash_str = bin2hex(hash_swap, 32);
-		target_str = bin2hex(target_swap, 32);
+		crypto::target256::hash_t target_le = target.to_le();
+		unsigned char hash_be[32], target_be[32];
+		char hash_str[65], target_str[65];
+		int i;
+
+		for (i = 0; i < 32; i++) {
+			hash_be[i] = hash[31 - i];
+			target_be[i] = target_le[31 - i];
+		}
+		hex::encode_to(hash_be, 32, hash_str);
+		hex::encode_to(target_be, 32, target_str);
+		hash_str[64] = target_str[64] = 0;
 
-		applog(LOG_DEBUG, " Proof: %s\nTarget: %s\nTrgVal? %s",
+		applog_async(LOG_DEBUG, " Proof: %s\nTarget: %s\nTrgVal? %s",
 			hash_str,
 			target_str,
-			rc ? "YES (hash < target)" :
+			rc ? "YES (hash <= target)" :
 			     "no (false positive; hash > target)");
-
-		free(hash_str);
-		free(target_str);
 	}
 
-	return true;	/* FIX-ME: return rc; */
+	return rc;
 }
 
-struct thread_q *tq_new(void)
+bool fulltest(const unsigned char *hash, const unsigned char *target)
 {
-	struct thread_q *tq;
-
-	tq = calloc(1, sizeof(*tq));
-	if (!tq)
-		return NULL;
-
-	INIT_LIST_HEAD(&tq->q);
-	pthread_mutex_init(&tq->mutex, NULL);
-	pthread_cond_init(&tq->cond, NULL);
-
-	return tq;
+	return fulltest(hash, crypto::target256::from_le(target));
 }
 
-void tq_free(struct thread_q *tq)
+struct thread_q *tq_new(void)
 {
-	struct tq_ent *ent, *iter;
-
-	if (!tq)
-		return;
-
-	list_for_each_entry_safe(ent, iter, &tq->q, q_node) {
-		list_del(&ent->q_node);
-		free(ent);
-	}
-
-	pthread_cond_destroy(&tq->cond);
-	pthread_mutex_destroy(&tq->mutex);
-
-	memset(tq, 0, sizeof(*tq));	/* poison */
-	free(tq);
+	return new (std::nothrow) thread_q;
 }
 
-static void tq_freezethaw(struct thread_q *tq, bool frozen)
+void tq_free(struct thread_q *tq)
 {
-	pthread_mutex_lock(&tq->mutex);
-
-	tq->frozen = frozen;
-
-	pthread_cond_signal(&tq->cond);
-	pthread_mutex_unlock(&tq->mutex);
+	delete tq;
 }
 
 void tq_freeze(struct thread_q *tq)
 {
-	tq_freezethaw(tq, true);
+	tq->q.freeze();
 }
 
 void tq_thaw(struct thread_q *tq)
 {
-	tq_freezethaw(tq, false);
+	tq->q.thaw();
 }
 
+/* fails when frozen, or when TQ_CAPACITY entries are already queued */
 bool tq_push(struct thread_q *tq, void *data)
 {
-	struct tq_ent *ent;
-	bool rc = true;
-
-	ent = calloc(1, sizeof(*ent));
-	if (!ent)
-		return false;
-
-	ent->data = data;
-	INIT_LIST_HEAD(&ent->q_node);
-
-	pthread_mutex_lock(&tq->mutex);
-
-	if (!tq->frozen) {
-		list_add_tail(&ent->q_node, &tq->q);
-	} else {
-		free(ent);
-		rc = false;
-	}
-
-	pthread_cond_signal(&tq->cond);
-	pthread_mutex_unlock(&tq->mutex);
-
-	return rc;
+	return tq->q.push(data);
 }
 
+/* NULL on timeout, or when woken by tq_freeze/tq_thaw with nothing queued */
 void *tq_pop(struct thread_q *tq, const struct timespec *abstime)
 {
-	struct tq_ent *ent;
-	void *rval = NULL;
-	int rc;
-
-	pthread_mutex_lock(&tq->mutex);
-
-	if (!list_empty(&tq->q))
-		goto pop;
+	std::optional<void *> rval;
 
-	if (abstime)
-		rc = pthread_cond_timedwait(&tq->cond, &tq->mutex, abstime);
-	else
-		rc = pthread_cond_wait(&tq->cond, &tq->mutex);
-	if (rc)
-		goto out;
-	if (list_empty(&tq->q))
-		goto out;
-
-pop:
-	ent = list_entry(tq->q.next, struct tq_ent, q_node);
-	rval = ent->data;
-
-	list_del(&ent->q_node);
-	free(ent);
+	if (!abstime)
+		rval = tq->q.pop();
+	else {
+		/* abstime is on CLOCK_REALTIME, as for pthread_cond_timedwait */
+		auto deadline = std::chrono::system_clock::time_point(
+			std::chrono::duration_cast<std::chrono::system_clock::duration>(
+				std::chrono::seconds(abstime->tv_sec) +
+				std::chrono::nanoseconds(abstime->tv_nsec)));
+		rval = tq->q.pop_for(deadline - std::chrono::system_clock::now());
+	}
 
-out:
-	pthread_mutex_unlock(&tq->mutex);
-	return rval;
+	return rval.value_or(nullptr);
 }
 